@@ -1,658 +1,3837 @@
 #include "Graph.h"
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <limits>
 #include <map>
+#include <new>
+#include <random>
 #include <queue>
-#include <set>
-#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const size_t Graph::EDGES_PER_SLAB;
+
+namespace {
+
+// Hands out the lines of a file while reading it in large blocks, so loading
+// an edge list costs one read per megabyte rather than one stream per line
+class LineReader {
+	public:
+		explicit LineReader(std::FILE *f) : file(f), buffer(1 << 20), start(0), size(0), eof(false) {}
+		~LineReader() { std::fclose(file); }
+
+		// Point [begin, end) at the next line, without its newline.
+		// Returns false once the file is exhausted.
+		bool next(const char *&begin, const char *&end) {
+			for (;;) {
+				const char *base = buffer.data();
+				const void *newline = std::memchr(base + start, '\n', size - start);
+				if (newline) {
+					begin = base + start;
+					end = static_cast<const char *>(newline);
+					start = end - base + 1;
+					return true;
+				}
+				if (eof) {
+					// A last line without a newline still counts
+					if (start == size) {
+						return false;
+					}
+					begin = base + start;
+					end = base + size;
+					start = size;
+					return true;
+				}
+				fill();
+			}
+		}
 
-// Construct an empty graph of the specified type
-Graph::Graph(Type t) {
-	directed = t == DIRECTED;
-	edgeList = std::vector<Edge *>(1, nullptr);
-	number_of_edges = 0;
-}
-		
-// Delete a graph
-Graph::~Graph() {
-	std::set<const Graph::Edge *> edges = allEdges();
-	for (auto a = edges.begin(); a != edges.end(); ++a) {
-		delete *a;
+	private:
+		// Keep the partial line and read the next block behind it
+		void fill() {
+			size -= start;
+			std::memmove(buffer.data(), buffer.data() + start, size);
+			start = 0;
+			if (size == buffer.size()) {
+				buffer.resize(buffer.size() * 2);
+			}
+			size_t got = std::fread(buffer.data() + size, 1, buffer.size() - size, file);
+			size += got;
+			eof = got == 0;
+		}
+
+		std::FILE *file;
+		std::vector<char> buffer;
+		size_t start;
+		size_t size;
+		bool eof;
+};
+
+const char *skipSpace(const char *p, const char *end) {
+	while (p != end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f')) {
+		++p;
 	}
-	return;
+	return p;
+}
+
+bool isDigit(char c) {
+	return c >= '0' && c <= '9';
 }
 
-std::set<const Graph::Edge *> Graph::allEdges(void) const {
-	std::set<const Graph::Edge *> edges;
-	for (size_t i = 1; i < edgeList.size(); ++i) {
-		Graph::Edge *e = edgeList[i];
-		while (e) {
-			edges.insert(e);
-			e = e->link[LEFT] ?: e->link[RIGHT];
+// Scan an unsigned decimal at p, advancing p past it
+bool scanUnsigned(const char *&p, const char *end, size_t &value) {
+	p = skipSpace(p, end);
+	if (p != end && *p == '+') {
+		++p;
+	}
+	if (p == end || !isDigit(*p)) {
+		return false;
+	}
+	value = 0;
+	for (; p != end && isDigit(*p); ++p) {
+		size_t digit = *p - '0';
+		if (value > (std::numeric_limits<size_t>::max() - digit) / 10) {
+			return false;
 		}
+		value = value * 10 + digit;
 	}
-
-	return edges;
+	return true;
 }
-		
-// Read a graph from a file
-void Graph::readFromFile(std::string file) {
-    std::ifstream inputFile(file);
-	if (!inputFile) {
-		std::cerr << "Could not open input file.\n";
-		return;
+
+// Scan a signed int at p, advancing p past it
+bool scanInt(const char *&p, const char *end, int &value) {
+	p = skipSpace(p, end);
+	bool negative = p != end && *p == '-';
+	if (p != end && (*p == '-' || *p == '+')) {
+		++p;
 	}
-		
-	std::string graphdef;
+	if (p == end || !isDigit(*p)) {
+		return false;
+	}
+	long long magnitude = 0;
+	for (; p != end && isDigit(*p); ++p) {
+		magnitude = magnitude * 10 + (*p - '0');
+		if (magnitude > static_cast<long long>(std::numeric_limits<int>::max()) + 1) {
+			return false;
+		}
+	}
+	if (!negative && magnitude > std::numeric_limits<int>::max()) {
+		return false;
+	}
+	value = static_cast<int>(negative ? -magnitude : magnitude);
+	return true;
+}
 
-	std::getline(inputFile, graphdef);
-	std::stringstream stream(graphdef);
-	stream >> graphdef;
-	if (graphdef == "directed") {
-		directed = true;
-	} else if (graphdef == "undirected") {
-		directed = false;
-	} else {
-		std::cerr << "Invalid graph input. Need direction.\n";
-		return;
+// Scan a decimal floating point number at p, advancing p past it. Plain
+// decimals with up to 15 significant digits are converted exactly from an
+// integer mantissa and a power of ten; anything longer goes through strtod.
+bool scanDouble(const char *&p, const char *end, double &value) {
+	static const double powers[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	p = skipSpace(p, end);
+	const char *token = p;
+	bool negative = p != end && *p == '-';
+	if (p != end && (*p == '-' || *p == '+')) {
+		++p;
 	}
 
-	// Number of Vertices
-	size_t numberVertices = 0;
-	std::string line;
-	std::getline(inputFile, line);
-	stream.str(line);
-	stream.clear();
-	if (!(stream >> numberVertices)) {
-		std::cerr << "Invalid graph input. Need number of vertices.\n";
-		return;
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+	for (; p != end && isDigit(*p); ++p, any = true) {
+		if (mantissa || *p != '0') {
+			++digits;
+		}
+		if (digits <= 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+		} else {
+			++exponent;
+		}
 	}
-	for (size_t i = 0; i < numberVertices; ++i) {
-		addVertex();
+	if (p != end && *p == '.') {
+		for (++p; p != end && isDigit(*p); ++p, any = true) {
+			if (mantissa || *p != '0') {
+				++digits;
+			}
+			if (digits <= 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				--exponent;
+			}
+		}
+	}
+	if (!any) {
+		return false;
+	}
+	if (p != end && (*p == 'e' || *p == 'E')) {
+		const char *mark = p;
+		++p;
+		bool negativeExponent = p != end && *p == '-';
+		if (p != end && (*p == '-' || *p == '+')) {
+			++p;
+		}
+		if (p == end || !isDigit(*p)) {
+			// Not an exponent after all; stop before the 'e'
+			p = mark;
+		} else {
+			int e = 0;
+			for (; p != end && isDigit(*p); ++p) {
+				if (e < 100000) {
+					e = e * 10 + (*p - '0');
+				}
+			}
+			exponent += negativeExponent ? -e : e;
+		}
 	}
 
-	// Number of Edges
-	size_t numberEdges = 0;
-	std::getline(inputFile, line);
-	stream.str(line);
-	stream.clear();
-	if (!(stream >> numberEdges)) {
-		std::cerr << "Invalid graph input. Need number of edges.\n";
-		return;
+	if (digits <= 15 && exponent >= -22 && exponent <= 22) {
+		double result = static_cast<double>(mantissa);
+		result = exponent < 0 ? result / powers[-exponent] : result * powers[exponent];
+		value = negative ? -result : result;
+		return true;
 	}
 
-	while (std::getline(inputFile, line)) {
-		std::stringstream stream(line);	
-		int node1, node2;
-		double weight;
-		if (!(stream >> node1)) {
-			std::cerr << "Invalid file format\n";
-			return;
-		}
-		if (!(stream >> node2)) {
-			std::cerr << "Invalid file format\n";
-			return;
+	std::string text(token, p);
+	value = std::strtod(text.c_str(), nullptr);
+	return true;
+}
+
+// Binary snapshot layout: this header, then the arrays of the CSR in the
+// order offsets, weights, targets, so that every array is naturally aligned
+struct SnapshotHeader {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byteOrder;
+	std::uint32_t directed;
+	std::uint32_t reserved;
+	std::uint64_t vertices;
+	std::uint64_t edges;
+	std::uint64_t outArcs;
+	std::uint64_t inArcs;
+};
+
+const char SNAPSHOT_MAGIC[8] = {'G', 'R', 'A', 'P', 'H', 'C', 'S', 'R'};
+const std::uint32_t SNAPSHOT_VERSION = 1;
+const std::uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+// Landmark file layout: this header, then the distances from the landmarks,
+// the distances to them (directed graphs only) and the landmarks themselves
+struct LandmarkHeader {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byteOrder;
+	std::uint32_t directed;
+	std::uint32_t count;
+	std::uint64_t vertices;
+	std::uint64_t edges;
+};
+
+// Hierarchy file layout: this header, then the offsets, weights, ranks,
+// targets and middles of the up arcs and the down arcs
+struct HierarchyHeader {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byteOrder;
+	std::uint32_t directed;
+	std::uint32_t reserved;
+	std::uint64_t vertices;
+	std::uint64_t edges;
+	std::uint64_t upArcs;
+	std::uint64_t downArcs;
+};
+
+const char HIERARCHY_MAGIC[8] = {'G', 'R', 'A', 'P', 'H', 'C', 'H', 'S'};
+const std::uint32_t HIERARCHY_VERSION = 1;
+
+// Hub label file layout: this header, then the out offsets, the in offsets
+// (directed graphs only), the out labels and the in labels
+struct HubLabelHeader {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byteOrder;
+	std::uint32_t directed;
+	std::uint32_t reserved;
+	std::uint64_t vertices;
+	std::uint64_t edges;
+	std::uint64_t outLabels;
+	std::uint64_t inLabels;
+};
+
+const char HUB_LABEL_MAGIC[8] = {'G', 'R', 'A', 'P', 'H', 'H', 'U', 'B'};
+const std::uint32_t HUB_LABEL_VERSION = 1;
+
+const char LANDMARK_MAGIC[8] = {'G', 'R', 'A', 'P', 'H', 'A', 'L', 'T'};
+const std::uint32_t LANDMARK_VERSION = 1;
+
+template <typename T>
+bool readArray(std::FILE *file, T *data, size_t count) {
+	return std::fread(data, sizeof(T), count, file) == count;
+}
+
+template <typename T>
+bool writeArray(std::FILE *file, const T *data, size_t count) {
+	return std::fwrite(data, sizeof(T), count, file) == count;
+}
+
+// Carve the next count elements of type T out of a mapped snapshot
+template <typename T>
+const T *takeArray(const char *base, size_t &cursor, size_t count) {
+	const T *array = reinterpret_cast<const T *>(base + cursor);
+	cursor += count * sizeof(T);
+	return array;
+}
+
+// Whether the offsets of a mapped run array start at 0, never fall and end
+// at count, so that every run lies inside the array
+bool validOffsets(const size_t *offset, size_t slots, size_t count) {
+	if (offset[0] != 0 || offset[slots] != count) {
+		return false;
+	}
+	for (size_t v = 0; v < slots; ++v) {
+		if (offset[v] > offset[v + 1]) {
+			return false;
 		}
-		if (!(stream >> weight)) {
-			std::cerr << "Invalid file format\n";
-			return;
+	}
+	return true;
+}
+
+// Vertices are numbered from 1; slot 0 is never one. The loaders, the
+// snapshot writer and the snapshot checks all go by this.
+bool isVertex(int v) {
+	return v >= 1;
+}
+
+// Whether every vertex in an array is a real one, 1 .. slots - 1
+bool validVertices(const int *vertex, size_t count, size_t slots) {
+	for (size_t i = 0; i < count; ++i) {
+		if (!isVertex(vertex[i]) || (size_t)vertex[i] >= slots) {
+			return false;
 		}
+	}
+	return true;
+}
 
-		addEdge(node1, node2, weight);
+// The first whitespace delimited word of a line
+std::string firstWord(const char *p, const char *end) {
+	p = skipSpace(p, end);
+	const char *word = p;
+	while (p != end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\v' && *p != '\f') {
+		++p;
 	}
+	return std::string(word, p);
 }
-		
-// Write a graph to a file
-void Graph::writeToFile(std::string file) {
-	std::ofstream outputFile(file.c_str());
-	
-	if (!outputFile) {
-		std::cerr << "Invalid file output.\n";
-		return;
+
+// Direction-optimizing BFS tuning (Beamer et al.): go bottom-up once the
+// frontier has more than 1/ALPHA of the unexplored arcs, and back top-down
+// once it is shrinking and holds fewer than 1/BETA of the vertices. A
+// bottom-up level scans every vertex, so a frontier smaller than that (say,
+// a small component found late by numConnectedComponents) and small graphs
+// stay top-down.
+const size_t BOTTOM_UP_ALPHA = 14;
+const size_t TOP_DOWN_BETA = 24;
+const size_t BOTTOM_UP_MIN_VERTICES = 1 << 12;
+
+// Delta-stepping aims for this many light arcs (no heavier than delta) out
+// of a vertex, judged from up to DELTA_SAMPLES weights
+const size_t DELTA_LIGHT_ARCS = 4;
+const size_t DELTA_SAMPLES = 1 << 12;
+
+// Afforest links each vertex to this many of its neighbors before guessing
+// the biggest component from this many sampled vertices
+const size_t AFFOREST_ROUNDS = 2;
+const size_t AFFOREST_SAMPLES = 1024;
+
+// A search level is split across threads once it has this many arcs (top-
+// down) or vertices (bottom-up) to scan; below that the threads cost more to
+// start than they save.
+const size_t PARALLEL_LEVEL_MIN_WORK = 1 << 14;
+
+// Point [line, lineEnd) at the line starting at p and move p past it, the
+// way LineReader::next does for a file in memory
+bool nextLine(const char *&p, const char *end, const char *&line, const char *&lineEnd) {
+	if (p == end) {
+		return false;
 	}
+	const void *newline = std::memchr(p, '\n', end - p);
+	line = p;
+	lineEnd = newline ? static_cast<const char *>(newline) : end;
+	p = newline ? lineEnd + 1 : end;
+	return true;
+}
 
-	if (directed) {
-		outputFile << "directed\n";
-	} else {
-		outputFile << "undirected\n";
+// Run body(thread, begin, end) over [0, count) split into one contiguous
+// block per thread. The calling thread takes the last block.
+template <typename F>
+void parallelFor(size_t count, unsigned threads, F body) {
+	if (threads > count) {
+		threads = count ? count : 1;
 	}
-	outputFile << edgeList.size()-1 << "\n";
-	outputFile << number_of_edges << "\n";
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t + 1 < threads; ++t) {
+		workers.push_back(std::thread([&body, t, count, threads]() {
+			body(t, count * t / threads, count * (t + 1) / threads);
+		}));
+	}
+	body(threads - 1, count * (threads - 1) / threads, count);
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+}
+
+// Turn counts into exclusive prefix sums in place: every block is summed,
+// the block totals are scanned, then each block is scanned from its base
+void parallelPrefixSum(std::vector<size_t> &values, unsigned threads) {
+	std::vector<size_t> totals(threads + 1, 0);
+	parallelFor(values.size(), threads, [&](unsigned t, size_t begin, size_t end) {
+		size_t sum = 0;
+		for (size_t i = begin; i < end; ++i) {
+			sum += values[i];
+		}
+		totals[t + 1] = sum;
+	});
+	for (unsigned t = 1; t <= threads; ++t) {
+		totals[t] += totals[t - 1];
+	}
+	parallelFor(values.size(), threads, [&](unsigned t, size_t begin, size_t end) {
+		size_t sum = totals[t];
+		for (size_t i = begin; i < end; ++i) {
+			size_t value = values[i];
+			values[i] = sum;
+			sum += value;
+		}
+	});
+}
+
+// A read-only mapping of a whole file, released on destruction
+class MappedFile {
+	public:
+		explicit MappedFile(const std::string &file) : base(nullptr), length(0), opened(false) {
+			int fd = open(file.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return;
+			}
+			struct stat info;
+			if (fstat(fd, &info) == 0) {
+				length = info.st_size;
+				opened = true;
+				if (length) {
+					void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+					opened = mapped != MAP_FAILED;
+					base = opened ? static_cast<const char *>(mapped) : nullptr;
+				}
+			}
+			close(fd);
+		}
+		~MappedFile() {
+			if (base) {
+				munmap(const_cast<char *>(base), length);
+			}
+		}
 
-	std::set<const Graph::Edge *> edges = allEdges();
-	for (auto a = edges.begin(); a != edges.end(); ++a) {
-		if (!(*a)) {
+		bool ok() const { return opened; }
+		const char *begin() const { return base; }
+		const char *end() const { return base + length; }
+
+	private:
+		const char *base;
+		size_t length;
+		bool opened;
+};
+
+// The edges one thread parsed out of its share of an edge list
+struct ParsedChunk {
+	std::vector<int> from;
+	std::vector<int> to;
+	std::vector<double> weight;
+	int maxVertex;
+	bool failed;
+};
+
+// Parse the edge lines in [begin, end) on the given number of threads. The
+// range is cut into one piece per thread on line boundaries; a piece stops
+// at its first malformed line, like the serial loader does.
+std::vector<ParsedChunk> parseEdgeChunks(const char *begin, const char *end, unsigned threads, bool directed) {
+	// Small inputs are not worth a thread per 64 KiB
+	size_t length = end - begin;
+	threads = std::max(1u, std::min<unsigned>(threads, length / (64 << 10) + 1));
+
+	std::vector<const char *> bound(threads + 1, end);
+	bound[0] = begin;
+	for (unsigned t = 1; t < threads; ++t) {
+		const char *raw = std::max(bound[t - 1], begin + length * t / threads);
+		if (raw == begin) {
+			bound[t] = begin;
 			continue;
 		}
+		const void *newline = std::memchr(raw - 1, '\n', end - raw + 1);
+		bound[t] = newline ? static_cast<const char *>(newline) + 1 : end;
+	}
+
+	std::vector<ParsedChunk> chunks(threads);
+	parallelFor(threads, threads, [&](unsigned, size_t first, size_t last) {
+		for (size_t t = first; t < last; ++t) {
+			ParsedChunk &chunk = chunks[t];
+			chunk.maxVertex = 0;
+			chunk.failed = false;
+			const char *p = bound[t];
+			const char *line;
+			const char *lineEnd;
+			while (nextLine(p, bound[t + 1], line, lineEnd)) {
+				int node1, node2;
+				double weight;
+				if (!scanInt(line, lineEnd, node1) || !scanInt(line, lineEnd, node2)
+						|| !scanDouble(line, lineEnd, weight) || !isVertex(node1) || !isVertex(node2)) {
+					chunk.failed = true;
+					break;
+				}
+				// Undirected edges are kept in LEFT/RIGHT order, as addEdge does
+				if (!directed && node2 < node1) {
+					std::swap(node1, node2);
+				}
+				chunk.from.push_back(node1);
+				chunk.to.push_back(node2);
+				chunk.weight.push_back(weight);
+				chunk.maxVertex = std::max(chunk.maxVertex, std::max(node1, node2));
+			}
+		}
+	});
+
+	// Nothing after the first malformed line is part of the graph
+	for (size_t t = 0; t < chunks.size(); ++t) {
+		if (chunks[t].failed) {
+			chunks.resize(t + 1);
+			break;
+		}
+	}
+	return chunks;
+}
 
-		if (!directed) {
-			outputFile << (*a)->vertex[LEFT] << " " << (*a)->vertex[RIGHT] << " " << (*a)->weight[LEFT] << "\n";
+// Disjoint sets of vertices, joined by size with paths halved on every find,
+// so any run of finds and joins takes near-linear time
+class DisjointSets {
+	public:
+		explicit DisjointSets(size_t count) : parent(count), members(count, 1) {
+			for (size_t i = 0; i < count; ++i) {
+				parent[i] = i;
+			}
+		}
+		int find(int v) {
+			while (parent[v] != v) {
+				parent[v] = parent[parent[v]];
+				v = parent[v];
+			}
+			return v;
 		}
-		else if (directed && (*a)->direction == 0) {
-			outputFile << (*a)->vertex[LEFT] << " " << (*a)->vertex[RIGHT] << " " << (*a)->weight[LEFT] << "\n";
-			outputFile << (*a)->vertex[RIGHT] << " " << (*a)->vertex[LEFT] << " " << (*a)->weight[RIGHT] << "\n";
+		// Join the sets holding a and b, returning false if they already
+		// were one
+		bool join(int a, int b) {
+			a = find(a);
+			b = find(b);
+			if (a == b) {
+				return false;
+			}
+			if (members[a] < members[b]) {
+				std::swap(a, b);
+			}
+			parent[b] = a;
+			members[a] += members[b];
+			return true;
 		}
-		else if (directed && (*a)->direction == 1) {
-			outputFile << (*a)->vertex[LEFT] << " " << (*a)->vertex[RIGHT] << " " << (*a)->weight[LEFT] << "\n";
+		// Number of vertices in the set led by root
+		int size(int root) const {
+			return members[root];
 		}
-		else {
-			outputFile << (*a)->vertex[RIGHT] << " " << (*a)->vertex[LEFT] << " " << (*a)->weight[RIGHT] << "\n";
+	private:
+		std::vector<int> parent;
+		std::vector<int> members;
+};
+
+// Turn per-vertex component roots into component numbers, in order of each
+// component's smallest vertex, counting the vertices of each into sizes.
+// Slot 0 is no vertex and gets -1.
+void numberComponents(std::vector<int> &id, std::vector<int> &sizes) {
+	std::vector<int> number(id.size(), -1);
+	sizes.clear();
+	for (size_t v = 1; v < id.size(); ++v) {
+		int root = id[v];
+		if (number[root] < 0) {
+			number[root] = sizes.size();
+			sizes.push_back(0);
 		}
+		id[v] = number[root];
+		++sizes[id[v]];
+	}
+	if (!id.empty()) {
+		id[0] = -1;
 	}
 }
-		
-// Empty
-bool Graph::empty() {
-	return (edgeList.size() < 2);
+
+// A key that sorts like the weight itself: positive weights get the sign bit
+// set and negative ones have every bit flipped
+std::uint64_t weightKey(double weight) {
+	if (weight == 0) {
+		// -0.0 ties with 0.0
+		weight = 0;
+	}
+	std::uint64_t bits;
+	std::memcpy(&bits, &weight, sizeof(bits));
+	return bits >> 63 ? ~bits : bits | std::uint64_t(1) << 63;
 }
 
-// Add an edge to the edge list
-void Graph::addEdge(int v1, int v2, double weight) {
-	if (edgeList.size() < 2) {
-		throw("Not enough space");
+// Orders edges by weight, then by their lower and higher end vertex, then by
+// edge number. Edges only tie on the first three when they print the same,
+// so every method writes the same forest, and Prim, which only sees arcs,
+// can follow the same order.
+struct Lighter {
+	Lighter(const double *w, const int *f, const int *t) : weight(w), from(f), to(t) {}
+	bool operator()(size_t e1, size_t e2) const {
+		if (weight[e1] != weight[e2]) {
+			return weight[e1] < weight[e2];
+		}
+		int low1 = std::min(from[e1], to[e1]);
+		int low2 = std::min(from[e2], to[e2]);
+		if (low1 != low2) {
+			return low1 < low2;
+		}
+		int high1 = std::max(from[e1], to[e1]);
+		int high2 = std::max(from[e2], to[e2]);
+		return high1 < high2 || (high1 == high2 && e1 < e2);
 	}
-	int node1 = std::min(v1, v2);
-	int node2 = std::max(v1, v2);
-	double weight1 = 0;
-	double weight2 = 0;
-	size_t direction = 0;
-	if (directed) {
-		if (node1 == v1) {
-			weight1 = weight;
-			direction = LEFT;
+	const double *weight;
+	const int *from;
+	const int *to;
+};
+
+// Stably sort order by key: a least significant digit radix sort, a byte
+// per pass, that skips the bytes every key shares. Each thread counts and
+// then scatters its own slice, slices in order, so equal keys keep their
+// order.
+void radixSort(std::vector<std::uint64_t> &key, std::vector<size_t> &order, unsigned threads) {
+	size_t count = key.size();
+	std::vector<std::uint64_t> keyBuffer(count);
+	std::vector<size_t> orderBuffer(count);
+	std::vector<size_t> histogram(threads * 256);
+	for (unsigned shift = 0; shift < 64; shift += 8) {
+		std::fill(histogram.begin(), histogram.end(), 0);
+		parallelFor(count, threads, [&](unsigned t, size_t begin, size_t end) {
+			size_t *counts = &histogram[t * 256];
+			for (size_t i = begin; i < end; ++i) {
+				++counts[key[i] >> shift & 255];
+			}
+		});
+
+		// Turn the counts into where each thread's run of each digit starts
+		size_t start = 0;
+		bool shared = false;
+		for (unsigned digit = 0; digit < 256; ++digit) {
+			size_t before = start;
+			for (unsigned t = 0; t < threads; ++t) {
+				size_t digits = histogram[t * 256 + digit];
+				histogram[t * 256 + digit] = start;
+				start += digits;
+			}
+			shared = shared || start - before == count;
 		}
-		else {
-			weight2 = weight;
-			direction = RIGHT;
+		if (shared) {
+			continue;
 		}
+
+		parallelFor(count, threads, [&](unsigned t, size_t begin, size_t end) {
+			size_t *next = &histogram[t * 256];
+			for (size_t i = begin; i < end; ++i) {
+				size_t slot = next[key[i] >> shift & 255]++;
+				keyBuffer[slot] = key[i];
+				orderBuffer[slot] = order[i];
+			}
+		});
+		key.swap(keyBuffer);
+		order.swap(orderBuffer);
 	}
-	else {
-		weight1 = weight;
-		weight2 = weight;
+}
+
+// Edge numbers 0 to count - 1 in Lighter order: radix sorted by weight,
+// then each run of equal weights sorted on its own. Each thread sorts the
+// runs that start in its slice.
+std::vector<size_t> sortEdges(const double *weight, const int *from, const int *to, size_t count, unsigned threads) {
+	if (threads > count || count < (1 << 16)) {
+		threads = 1;
 	}
-	// Need to make sure the list can hold largest node
-	for (size_t i = edgeList.size(); i < (unsigned)std::max(v1,v2); ++i) {
-		addVertex();
+	std::vector<std::uint64_t> key(count);
+	std::vector<size_t> order(count);
+	parallelFor(count, threads, [&](unsigned, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			key[i] = weightKey(weight[i]);
+			order[i] = i;
+		}
+	});
+	radixSort(key, order, threads);
+
+	Lighter lighter(weight, from, to);
+	parallelFor(count, threads, [&](unsigned, size_t begin, size_t end) {
+		size_t i = begin;
+		while (i < end && i > 0 && key[i] == key[i - 1]) {
+			++i;
+		}
+		while (i < end) {
+			size_t run = i + 1;
+			while (run < count && key[run] == key[i]) {
+				++run;
+			}
+			if (run - i > 1) {
+				std::sort(order.begin() + i, order.begin() + run, lighter);
+			}
+			i = run;
+		}
+	});
+	return order;
+}
+
+// Kruskal: take the edges in order while they join two trees, until the
+// forest has spanning edges
+void kruskal(const size_t *first, const size_t *last, const int *from, const int *to, size_t spanning,
+		DisjointSets &sets, std::vector<size_t> &taken) {
+	for (; first != last && taken.size() < spanning; ++first) {
+		// Both nodes already belong to the same set; taking this edge would
+		// introduce a cycle.
+		if (sets.join(from[*first], to[*first])) {
+			taken.push_back(*first);
+		}
 	}
-	// Allocates an Edge on the heap
-	// Edge is inserted at the front of the edge list for both node values
-	// The left & right pointers are adjusted to point to the previous first edges in the list
-	Edge *e = new Edge(node1, node2, weight1, weight2, direction, nullptr, nullptr);
-	number_of_edges++;
+}
 
-	if (!edgeList[node1]) {
-		edgeList[node1] = e;
-	} else {
-		Edge *current = edgeList[node1];
-		while (current) {
-			if (current->vertex[LEFT] == e->vertex[LEFT]) {
-				if (current->link[LEFT] && current->link[LEFT]->vertex[RIGHT] >= e->vertex[RIGHT]) {
-					e->link[LEFT] = current->link[LEFT];
-					if (edgeList[node1] == current) {
-						edgeList[node1] = e;
-					}
+// Edge sets at most this big are sorted outright by filterKruskal
+const size_t FILTER_KRUSKAL_BASE = 1 << 10;
+
+// Filter-Kruskal (Osipov, Sanders and Singler) over the edge numbers in
+// [first, last): split them around a random pivot, run on the light side,
+// then drop the heavy edges that now fall inside one tree before running on
+// what is left. Most heavy edges are filtered out without being sorted.
+void filterKruskal(size_t *first, size_t *last, const double *weight, const int *from, const int *to,
+		size_t spanning, DisjointSets &sets, std::vector<size_t> &taken, std::mt19937 &random) {
+	Lighter lighter(weight, from, to);
+	while (taken.size() < spanning) {
+		size_t count = last - first;
+		if (count <= FILTER_KRUSKAL_BASE) {
+			std::sort(first, last, lighter);
+			kruskal(first, last, from, to, spanning, sets, taken);
+			return;
+		}
 
-					break;
-				} else if (current->link[LEFT] && current->link[LEFT]->vertex[RIGHT] < e->vertex[RIGHT]) {
-					current = current->link[LEFT];
-				} else {
-					current->link[LEFT] = e;
-					break;
+		size_t pivot = first[random() % count];
+		size_t *middle = std::partition(first, last, [&](size_t e) {
+			return !lighter(pivot, e);
+		});
+		filterKruskal(first, middle, weight, from, to, spanning, sets, taken, random);
+		first = std::partition(middle, last, [&](size_t e) {
+			return sets.find(from[e]) == sets.find(to[e]);
+		});
+	}
+}
+
+// Parallel Boruvka: every round, each tree finds its lightest edge out with
+// an atomic minimum, those edges are taken and their trees merged, and the
+// edges left inside one tree are dropped. Trees are named by a root vertex.
+// Returns the forest's edges in no particular order.
+std::vector<size_t> boruvka(size_t vertices, size_t edges, const double *weight, const int *from, const int *to,
+		unsigned threads) {
+	const size_t none = std::numeric_limits<size_t>::max();
+	Lighter lighter(weight, from, to);
+	std::vector<int> tree(vertices);
+	std::vector<int> hook(vertices);
+	std::vector<std::atomic<size_t>> best(vertices);
+	parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+		for (size_t v = begin; v < end; ++v) {
+			tree[v] = v;
+		}
+	});
+
+	std::vector<size_t> alive(edges);
+	parallelFor(edges, threads, [&](unsigned, size_t begin, size_t end) {
+		for (size_t e = begin; e < end; ++e) {
+			alive[e] = e;
+		}
+	});
+	std::vector<int> roots(tree);
+	std::vector<size_t> taken;
+	std::vector<std::vector<size_t>> pieces(threads);
+	while (true) {
+		// Keep the edges still between two trees
+		parallelFor(alive.size(), threads, [&](unsigned t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				if (tree[from[alive[i]]] != tree[to[alive[i]]]) {
+					pieces[t].push_back(alive[i]);
 				}
-			} else {
-				if (current->link[RIGHT] && current->link[RIGHT]->vertex[RIGHT] >= e->vertex[RIGHT]) {
-					e->link[LEFT] = current->link[LEFT];
-					if (edgeList[node2] == current) {
-						edgeList[node2] = e;
-					}
+			}
+		});
+		alive.clear();
+		for (std::vector<size_t> &piece : pieces) {
+			alive.insert(alive.end(), piece.begin(), piece.end());
+			piece.clear();
+		}
+		if (alive.empty()) {
+			break;
+		}
 
-					break;
-				} else if (current->link[RIGHT] && current->link[RIGHT]->vertex[RIGHT] < e->vertex[RIGHT]) {
-					current = current->link[RIGHT];
+		parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				best[v].store(none, std::memory_order_relaxed);
+			}
+		});
+		auto offer = [&](int t, size_t e) {
+			size_t current = best[t].load(std::memory_order_relaxed);
+			while ((current == none || lighter(e, current))
+					&& !best[t].compare_exchange_weak(current, e, std::memory_order_relaxed)) {
+			}
+		};
+		parallelFor(alive.size(), threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				offer(tree[from[alive[i]]], alive[i]);
+				offer(tree[to[alive[i]]], alive[i]);
+			}
+		});
+
+		// Each tree hooks onto the tree across its edge. With no ties, the
+		// only cycles are pairs of trees that picked the same edge; the
+		// lower named one of those stays a root and the other takes the edge.
+		parallelFor(roots.size(), threads, [&](unsigned t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				size_t c = roots[i];
+				size_t e = best[c].load(std::memory_order_relaxed);
+				if (e == none) {
+					hook[c] = c;
+					continue;
+				}
+				int other = tree[from[e]] == (int)c ? tree[to[e]] : tree[from[e]];
+				if (best[other].load(std::memory_order_relaxed) == e && (int)c < other) {
+					hook[c] = c;
 				} else {
-					current->link[RIGHT] = e;
-					break;
+					hook[c] = other;
+					pieces[t].push_back(e);
 				}
 			}
+		});
+		for (std::vector<size_t> &piece : pieces) {
+			taken.insert(taken.end(), piece.begin(), piece.end());
+			piece.clear();
 		}
-	}
-
-	if (!edgeList[node2]) {
-		edgeList[node2] = e;
-	} else {
-		Edge *current = edgeList[node2];
-		while (current) {
-			if (current->vertex[RIGHT] == e->vertex[RIGHT]) {
-				if (current->link[RIGHT] && current->link[RIGHT]->vertex[LEFT] >= e->vertex[LEFT]) {
-					e->link[RIGHT] = current->link[RIGHT];
-					if (edgeList[node2] == current) {
-						edgeList[node2] = e;
-					}
 
-					break;
-				} else if (current->link[RIGHT] && current->link[RIGHT]->vertex[LEFT] < e->vertex[LEFT]) {
-					current = current->link[RIGHT];
-				} else {
-					current->link[RIGHT] = e;
-					break;
+		// Find each merged tree's root by pointer jumping: every pass points
+		// each tree at its hook's hook, halving the chains, so a chain as
+		// long as the graph takes a logarithmic number of passes
+		bool jumped = true;
+		while (jumped) {
+			std::atomic<bool> changed(false);
+			parallelFor(roots.size(), threads, [&](unsigned, size_t begin, size_t end) {
+				bool local = false;
+				for (size_t i = begin; i < end; ++i) {
+					int c = roots[i];
+					int next = hook[hook[c]];
+					local = local || next != hook[c];
+					best[c].store(next, std::memory_order_relaxed);
 				}
-			} else {
-				if (current->link[LEFT] && current->link[LEFT]->vertex[LEFT] >= e->vertex[LEFT]) {
-					e->link[RIGHT] = current->link[RIGHT];
-					if (edgeList[node1] == current) {
-						edgeList[node1] = e;
-					}
+				if (local) {
+					changed.store(true, std::memory_order_relaxed);
+				}
+			});
+			parallelFor(roots.size(), threads, [&](unsigned, size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					hook[roots[i]] = best[roots[i]].load(std::memory_order_relaxed);
+				}
+			});
+			jumped = changed.load();
+		}
 
-					break;
-				} else if (current->link[LEFT] && current->link[LEFT]->vertex[LEFT] < e->vertex[LEFT]) {
-					current = current->link[LEFT];
-				} else {
-					current->link[LEFT] = e;
-					break;
+		// Rename every vertex's tree and keep the roots still standing
+		parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				hook[v] = best[tree[v]].load(std::memory_order_relaxed);
+			}
+		});
+		parallelFor(roots.size(), threads, [&](unsigned t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				if (hook[roots[i]] == roots[i]) {
+					pieces[t].push_back(roots[i]);
 				}
 			}
+		});
+		roots.clear();
+		for (std::vector<size_t> &piece : pieces) {
+			roots.insert(roots.end(), piece.begin(), piece.end());
+			piece.clear();
 		}
+		tree.swap(hook);
 	}
+	return taken;
 }
-	
-// Add a vertex to the head of the edge list
-void Graph::addVertex() {
-	// All we need to do is allocated space for an edge
-	// There is no need to keep track of node values
-	edgeList.push_back(nullptr);
-}
-		
-int Graph::numConnectedComponents() {
-	size_t components = 0;
-	std::vector<bool> visited(edgeList.size(), false);
-	for (size_t i = 1; i < visited.size(); ++i) {
-		if (!visited[i]) {
-			++components;
-			breadthFirstApply(visited, i, [&](int){ return false; }, true);
-		}
-	}
 
-	return components;
-}
-		
-// Tree check
-bool Graph::tree() {
-//	std::cout << "Size: " << edgeList.size()-1 << " Edges: " << number_of_edges << "\n";
-	// Undirected case
-	// std::cout << "Size: " << edgeList.size() - 1 << " Edges: " << number_of_edges << "\n";
-
-	// if (!directed && (edgeList.size() - 2) != number_of_edges) {
-	// 	return false;
-	// }
-	if (directed && (number_of_edges >= edgeList.size() - 1)) {
-		return false;
-	}
+// Indexed 4-ary min-heap of vertices under less. Four children to a node
+// make the heap shallow and keep each node's children side by side, and
+// the position index lets a vertex already in it move up when its key
+// drops.
+template <typename Less>
+class VertexHeap {
+	public:
+		VertexHeap(size_t vertices, Less l) : position(vertices, -1), less(l) {}
+		bool empty() const {
+			return heap.empty();
+		}
+		// Add v, or move it up after its key dropped
+		void push(int v) {
+			if (position[v] < 0) {
+				position[v] = heap.size();
+				heap.push_back(v);
+			}
+			up(position[v]);
+		}
+		int pop() {
+			int top = heap[0];
+			position[top] = -1;
+			int last = heap.back();
+			heap.pop_back();
+			if (!heap.empty()) {
+				heap[0] = last;
+				down(0);
+			}
+			return top;
+		}
+	private:
+		void place(int v, size_t i) {
+			heap[i] = v;
+			position[v] = i;
+		}
+		void up(size_t i) {
+			int v = heap[i];
+			while (i > 0 && less(v, heap[(i - 1) / 4])) {
+				place(heap[(i - 1) / 4], i);
+				i = (i - 1) / 4;
+			}
+			place(v, i);
+		}
+		void down(size_t i) {
+			int v = heap[i];
+			while (4 * i + 1 < heap.size()) {
+				size_t first = 4 * i + 1;
+				size_t least = first;
+				for (size_t c = first + 1; c < std::min(first + 4, heap.size()); ++c) {
+					if (less(heap[c], heap[least])) {
+						least = c;
+					}
+				}
+				if (!less(heap[least], v)) {
+					break;
+				}
+				place(heap[least], i);
+				i = least;
+			}
+			place(v, i);
+		}
+
+		std::vector<int> heap;
+		std::vector<int> position;
+		Less less;
+};
+
+// Monotone radix heap (Ahuja, Mehlhorn, Orlin and Tarjan) of vertices by
+// distance. Keys never fall below the last one popped, so bucket i holds the
+// keys whose highest bit differing from it is bit i - 1; refilling bucket 0
+// from the lowest nonempty bucket only ever moves a key down, at most 64
+// times, without comparing keys. A vertex may be in the heap more than once;
+// the caller skips stale entries. Nonnegative doubles sort the same as their
+// bits, which are the keys.
+class RadixHeap {
+	public:
+		RadixHeap() : last(0), count(0) {}
+		bool empty() const {
+			return count == 0;
+		}
+		void push(double distance, int v) {
+			std::uint64_t key = bitsOf(distance);
+			buckets[bucketOf(key)].push_back(std::make_pair(key, v));
+			++count;
+		}
+		int pop() {
+			if (buckets[0].empty()) {
+				size_t i = 1;
+				while (buckets[i].empty()) {
+					++i;
+				}
+				last = buckets[i][0].first;
+				for (const std::pair<std::uint64_t, int> &item : buckets[i]) {
+					last = std::min(last, item.first);
+				}
+				for (const std::pair<std::uint64_t, int> &item : buckets[i]) {
+					buckets[bucketOf(item.first)].push_back(item);
+				}
+				buckets[i].clear();
+			}
+			int v = buckets[0].back().second;
+			buckets[0].pop_back();
+			--count;
+			return v;
+		}
+	private:
+		static std::uint64_t bitsOf(double distance) {
+			std::uint64_t bits;
+			std::memcpy(&bits, &distance, sizeof(bits));
+			return bits;
+		}
+		size_t bucketOf(std::uint64_t key) const {
+			return key == last ? 0 : 64 - __builtin_clzll(key ^ last);
+		}
+
+		std::vector<std::pair<std::uint64_t, int>> buckets[65];
+		std::uint64_t last;
+		size_t count;
+};
+
+// A witness search gives up after settling this many vertices (a shortcut
+// it failed to rule out is merely redundant), or after this many when it
+// only estimates the shortcuts a contraction would need
+const size_t WITNESS_SETTLED = 256;
+const size_t ESTIMATE_SETTLED = 32;
+
+// Contraction hierarchy preprocessing, over a copy of the graph's arcs in
+// which a vertex's arcs are taken out of its neighbors' lists once it is
+// contracted. What is left in its own lists then leads to higher ranks.
+class Contraction {
+	public:
+		struct Arc {
+			int vertex;
+			double weight;
+			int middle;
+		};
+
+		explicit Contraction(size_t vertices)
+			: out(vertices), in(vertices), mark(vertices, 0), target(vertices, 0), epoch(0), cost(vertices) {}
+
+		// Add an arc, or lower the weight of the one already there
+		void addArc(int from, int to, double weight, int middle) {
+			if (from == to) {
+				return;
+			}
+			for (Arc &arc : out[from]) {
+				if (arc.vertex == to) {
+					if (weight < arc.weight) {
+						arc.weight = weight;
+						arc.middle = middle;
+						for (Arc &back : in[to]) {
+							if (back.vertex == from) {
+								back.weight = weight;
+								back.middle = middle;
+							}
+						}
+					}
+					return;
+				}
+			}
+			out[from].push_back(Arc{to, weight, middle});
+			in[to].push_back(Arc{from, weight, middle});
+		}
+
+		// The shortcuts contracting v needs, added when add is set: one for
+		// each path u -> v -> w that no path around v is as short as
+		size_t shortcuts(int v, bool add) {
+			double longest = 0;
+			for (const Arc &second : out[v]) {
+				longest = std::max(longest, second.weight);
+			}
+			size_t count = 0;
+			for (const Arc &first : in[v]) {
+				witness(first.vertex, v, first.weight + longest, add ? WITNESS_SETTLED : ESTIMATE_SETTLED);
+				for (const Arc &second : out[v]) {
+					double via = first.weight + second.weight;
+					if (second.vertex == first.vertex || (reached(second.vertex) && cost[second.vertex] <= via)) {
+						continue;
+					}
+					++count;
+					if (add) {
+						addArc(first.vertex, second.vertex, via, v);
+					}
+				}
+			}
+			return count;
+		}
+
+		// Edge difference: shortcuts added less arcs removed, counted
+		// twice to outweigh the neighbors a vertex has lost
+		int priority(int v) {
+			return 2 * (int(shortcuts(v, false)) - int(in[v].size() + out[v].size()));
+		}
+
+		// Contract v, leaving its lists as its up and down arcs
+		void contract(int v) {
+			shortcuts(v, true);
+			for (const Arc &arc : out[v]) {
+				drop(in[arc.vertex], v);
+			}
+			for (const Arc &arc : in[v]) {
+				drop(out[arc.vertex], v);
+			}
+		}
+
+		std::vector<std::vector<Arc>> out;
+		std::vector<std::vector<Arc>> in;
+	private:
+		static void drop(std::vector<Arc> &arcs, int v) {
+			for (size_t i = 0; i < arcs.size(); ++i) {
+				if (arcs[i].vertex == v) {
+					arcs[i] = arcs.back();
+					arcs.pop_back();
+					return;
+				}
+			}
+		}
+		bool reached(int v) const {
+			return mark[v] == epoch;
+		}
+
+		// Dijkstra from source around skip, no farther than limit, until
+		// it settles every vertex skip has an arc to or most vertices
+		void witness(int source, int skip, double limit, size_t most) {
+			typedef std::pair<double, int> Entry;
+			++epoch;
+			size_t targets = 0;
+			for (const Arc &arc : out[skip]) {
+				if (target[arc.vertex] != epoch) {
+					target[arc.vertex] = epoch;
+					++targets;
+				}
+			}
+			heap.clear();
+			mark[source] = epoch;
+			cost[source] = 0;
+			heap.push_back(Entry(0, source));
+			size_t settled = 0;
+			while (!heap.empty() && settled < most) {
+				std::pop_heap(heap.begin(), heap.end(), std::greater<Entry>());
+				Entry top = heap.back();
+				heap.pop_back();
+				if (top.first > cost[top.second]) {
+					continue;
+				}
+				if (top.first > limit) {
+					break;
+				}
+				if (target[top.second] == epoch && --targets == 0) {
+					break;
+				}
+				++settled;
+				for (const Arc &arc : out[top.second]) {
+					double through = top.first + arc.weight;
+					if (arc.vertex == skip || (reached(arc.vertex) && cost[arc.vertex] <= through)) {
+						continue;
+					}
+					mark[arc.vertex] = epoch;
+					cost[arc.vertex] = through;
+					heap.push_back(Entry(through, arc.vertex));
+					std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+				}
+			}
+		}
+
+		std::vector<unsigned> mark;
+		std::vector<unsigned> target;
+		unsigned epoch;
+		std::vector<double> cost;
+		std::vector<std::pair<double, int>> heap;
+};
+
+// Hub labels are built one hub at a time at first, while each hub's search
+// still reaches far; after that the graph's threads take batches of up to
+// LABEL_BATCH hubs, and at most 1/LABEL_BATCH_SHARE of the hubs done so far.
+// Hubs in one batch cannot prune with each other's labels, which only adds
+// labels that are not needed.
+const size_t LABEL_BATCH = 1024;
+const size_t LABEL_BATCH_SHARE = 16;
+
+// MST picks Prim on its own once the graph has at least 1/PRIM_DENSITY of
+// the edges it could have
+const size_t PRIM_DENSITY = 8;
+
+}
+
+// Construct an empty graph of the specified type
+Graph::Graph(Type t) {
+	directed = t == DIRECTED;
+	slotCount = 1;
+	number_of_edges = 0;
+	csr = CSR();
+	compiled = false;
+	mapping = nullptr;
+	mappingLength = 0;
+	hubLabels = HubLabels();
+	labelMapping = nullptr;
+	labelMappingLength = 0;
+	csrOnly = false;
+	threads = std::max(1u, std::thread::hardware_concurrency());
+}
+		
+// Delete a graph
+Graph::~Graph() {
+	// Edges need no destructor call, so releasing the slabs is enough
+	static_assert(std::is_trivially_destructible<Edge>::value, "Edges are freed with their slab");
+	for (Edge *slab : slabs) {
+		std::free(slab);
+	}
+	unmap();
+	dropHubLabels();
+	return;
+}
+
+// Place a new edge in the current slab, starting a new slab when it is full.
+// The edge becomes visible to forEachEdge once number_of_edges is bumped.
+Graph::Edge *Graph::allocateEdge(int v1, int v2, double w1, double w2, int d) {
+	if (number_of_edges == slabs.size() * EDGES_PER_SLAB) {
+		Edge *slab = static_cast<Edge *>(std::malloc(EDGES_PER_SLAB * sizeof(Edge)));
+		if (!slab) {
+			throw std::bad_alloc();
+		}
+		slabs.push_back(slab);
+	}
+
+	return new (slabs.back() + number_of_edges % EDGES_PER_SLAB) Edge(v1, v2, w1, w2, d);
+}
+
+// Call visit on every edge in the order the edges were added
+template <typename F>
+void Graph::forEachEdge(F visit) const {
+	for (size_t s = 0; s < slabs.size(); ++s) {
+		size_t count = std::min(EDGES_PER_SLAB, number_of_edges - s * EDGES_PER_SLAB);
+		for (size_t i = 0; i < count; ++i) {
+			visit(slabs[s][i]);
+		}
+	}
+}
+		
+// Read a graph from a file
+void Graph::readFromFile(std::string file) {
+	std::FILE *input = std::fopen(file.c_str(), "rb");
+	if (!input) {
+		std::cerr << "Could not open input file.\n";
+		return;
+	}
+	LineReader inputFile(input);
+
+	const char *line = nullptr;
+	const char *end = nullptr;
+	if (!inputFile.next(line, end)) {
+		line = end = nullptr;
+	}
+	std::string graphdef = firstWord(line, end);
+	if (graphdef == "directed") {
+		directed = true;
+	} else if (graphdef == "undirected") {
+		directed = false;
+	} else {
+		std::cerr << "Invalid graph input. Need direction.\n";
+		return;
+	}
+
+	// Number of Vertices
+	size_t numberVertices = 0;
+	if (!inputFile.next(line, end) || !scanUnsigned(line, end, numberVertices)) {
+		std::cerr << "Invalid graph input. Need number of vertices.\n";
+		return;
+	}
+	for (size_t i = 0; i < numberVertices; ++i) {
+		addVertex();
+	}
+
+	// Number of Edges
+	size_t numberEdges = 0;
+	if (!inputFile.next(line, end) || !scanUnsigned(line, end, numberEdges)) {
+		std::cerr << "Invalid graph input. Need number of edges.\n";
+		return;
+	}
+
+	while (inputFile.next(line, end)) {
+		int node1, node2;
+		double weight;
+		if (!scanInt(line, end, node1) || !scanInt(line, end, node2) || !scanDouble(line, end, weight)
+				|| !isVertex(node1) || !isVertex(node2)) {
+			std::cerr << "Invalid file format\n";
+			return;
+		}
+
+		addEdge(node1, node2, weight);
+	}
+}
+		
+// Read a graph from a file on all of the graph's threads, straight into
+// CSR form
+void Graph::readFromFileParallel(std::string file) {
+	// Adding to an existing graph has to go through addEdge
+	if (!empty()) {
+		readFromFile(file);
+		return;
+	}
+
+	MappedFile input(file);
+	if (!input.ok()) {
+		std::cerr << "Could not open input file.\n";
+		return;
+	}
+
+	const char *p = input.begin();
+	const char *line = nullptr;
+	const char *end = nullptr;
+	if (!nextLine(p, input.end(), line, end)) {
+		line = end = nullptr;
+	}
+	std::string graphdef = firstWord(line, end);
+	if (graphdef == "directed") {
+		directed = true;
+	} else if (graphdef == "undirected") {
+		directed = false;
+	} else {
+		std::cerr << "Invalid graph input. Need direction.\n";
+		return;
+	}
+
+	// Number of Vertices
+	size_t numberVertices = 0;
+	if (!nextLine(p, input.end(), line, end) || !scanUnsigned(line, end, numberVertices)) {
+		std::cerr << "Invalid graph input. Need number of vertices.\n";
+		return;
+	}
+
+	// Number of Edges
+	size_t numberEdges = 0;
+	std::vector<ParsedChunk> chunks;
+	if (!nextLine(p, input.end(), line, end) || !scanUnsigned(line, end, numberEdges)) {
+		std::cerr << "Invalid graph input. Need number of edges.\n";
+	} else {
+		chunks = parseEdgeChunks(p, input.end(), threads, directed);
+		if (!chunks.empty() && chunks.back().failed) {
+			std::cerr << "Invalid file format\n";
+		}
+	}
+
+	// Stitch the chunks together in file order
+	std::vector<size_t> start(chunks.size() + 1, 0);
+	size_t vertices = numberVertices + 1;
+	for (size_t c = 0; c < chunks.size(); ++c) {
+		start[c + 1] = start[c] + chunks[c].weight.size();
+		vertices = std::max(vertices, static_cast<size_t>(chunks[c].maxVertex) + 1);
+	}
+	storage = CSRStorage();
+	storage.from.resize(start.back());
+	storage.to.resize(start.back());
+	storage.weight.resize(start.back());
+	parallelFor(chunks.size(), threads, [&](unsigned, size_t first, size_t last) {
+		for (size_t c = first; c < last; ++c) {
+			std::copy(chunks[c].from.begin(), chunks[c].from.end(), storage.from.begin() + start[c]);
+			std::copy(chunks[c].to.begin(), chunks[c].to.end(), storage.to.begin() + start[c]);
+			std::copy(chunks[c].weight.begin(), chunks[c].weight.end(), storage.weight.begin() + start[c]);
+			std::vector<int>().swap(chunks[c].from);
+			std::vector<int>().swap(chunks[c].to);
+			std::vector<double>().swap(chunks[c].weight);
+		}
+	});
+
+	unmap();
+	number_of_edges = start.back();
+	csrOnly = true;
+	buildCSR(vertices);
+}
+
+// Set how many threads the parallel loader and algorithms use
+void Graph::setThreads(unsigned count) {
+	threads = std::max(1u, count);
+}
+
+// Write a graph to a file
+void Graph::writeToFile(std::string file) {
+	std::ofstream outputFile(file.c_str());
+	
+	if (!outputFile) {
+		std::cerr << "Invalid file output.\n";
+		return;
+	}
+
+	if (directed) {
+		outputFile << "directed\n";
+	} else {
+		outputFile << "undirected\n";
+	}
+	outputFile << vertexSlots()-1 << "\n";
+	outputFile << number_of_edges << "\n";
+
+	const CSR &graph = frozen();
+	for (size_t e = 0; e < graph.edges; ++e) {
+		outputFile << graph.from[e] << " " << graph.to[e] << " " << graph.weight[e] << "\n";
+	}
+}
+		
+// Write the compiled graph to a binary snapshot file
+bool Graph::writeSnapshot(std::string file) {
+	const CSR &graph = frozen();
+	// Only what mapSnapshot would take back is written; addEdge alone lets
+	// slot 0 in
+	if (!validVertices(graph.from, graph.edges, graph.vertices)
+			|| !validVertices(graph.to, graph.edges, graph.vertices)) {
+		std::cerr << "Invalid vertex.\n";
+		return false;
+	}
+
+	std::FILE *output = std::fopen(file.c_str(), "wb");
+	if (!output) {
+		std::cerr << "Invalid file output.\n";
+		return false;
+	}
+
+	SnapshotHeader header = SnapshotHeader();
+	std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byteOrder = SNAPSHOT_BYTE_ORDER;
+	header.directed = directed;
+	header.vertices = graph.vertices;
+	header.edges = graph.edges;
+	header.outArcs = graph.out.offset[graph.vertices];
+	header.inArcs = directed ? graph.in.offset[graph.vertices] : 0;
+
+	bool ok = writeArray(output, &header, 1)
+		&& writeArray(output, graph.out.offset, graph.vertices + 1)
+		&& (!directed || writeArray(output, graph.in.offset, graph.vertices + 1))
+		&& writeArray(output, graph.out.weight, header.outArcs)
+		&& writeArray(output, graph.in.weight, header.inArcs)
+		&& writeArray(output, graph.weight, graph.edges)
+		&& writeArray(output, graph.out.target, header.outArcs)
+		&& writeArray(output, graph.in.target, header.inArcs)
+		&& writeArray(output, graph.from, graph.edges)
+		&& writeArray(output, graph.to, graph.edges);
+	ok = std::fclose(output) == 0 && ok;
+	if (!ok) {
+		std::cerr << "Invalid file output.\n";
+	}
+	return ok;
+}
+
+// Replace the graph with a mapped snapshot
+bool Graph::mapSnapshot(std::string file) {
+	// The arrays are used in place, so their layout must match the file's
+	static_assert(sizeof(size_t) == sizeof(std::uint64_t) && sizeof(int) == sizeof(std::int32_t),
+			"Snapshots store 64-bit offsets and 32-bit vertices");
+
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "Could not open input file.\n";
+		return false;
+	}
+	struct stat info;
+	void *base = MAP_FAILED;
+	size_t length = 0;
+	if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(SnapshotHeader)) {
+		length = info.st_size;
+		base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (base == MAP_FAILED) {
+		std::cerr << "Invalid snapshot file.\n";
+		return false;
+	}
+
+	const char *bytes = static_cast<const char *>(base);
+	SnapshotHeader header;
+	std::memcpy(&header, bytes, sizeof(header));
+	// Every count is checked against the file's length before the sizes
+	// are worked out, so they cannot overflow
+	bool valid = std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == SNAPSHOT_VERSION
+		&& header.byteOrder == SNAPSHOT_BYTE_ORDER
+		&& header.vertices >= 1
+		&& header.vertices < length && header.edges < length
+		&& header.outArcs < length && header.inArcs < length
+		&& (header.directed || header.inArcs == 0);
+	size_t offsets = header.vertices + 1;
+	size_t expected = sizeof(header)
+		+ (header.directed ? 2 : 1) * offsets * sizeof(size_t)
+		+ (header.outArcs + header.inArcs + header.edges) * sizeof(double)
+		+ (header.outArcs + header.inArcs + 2 * header.edges) * sizeof(int);
+	CSR mapped = CSR();
+	if (valid && expected == length) {
+		size_t cursor = sizeof(header);
+		mapped.vertices = header.vertices;
+		mapped.edges = header.edges;
+		mapped.out.offset = takeArray<size_t>(bytes, cursor, offsets);
+		mapped.in.offset = header.directed ? takeArray<size_t>(bytes, cursor, offsets) : mapped.out.offset;
+		mapped.out.weight = takeArray<double>(bytes, cursor, header.outArcs);
+		mapped.in.weight = header.directed ? takeArray<double>(bytes, cursor, header.inArcs) : mapped.out.weight;
+		mapped.weight = takeArray<double>(bytes, cursor, header.edges);
+		mapped.out.target = takeArray<int>(bytes, cursor, header.outArcs);
+		mapped.in.target = header.directed ? takeArray<int>(bytes, cursor, header.inArcs) : mapped.out.target;
+		mapped.from = takeArray<int>(bytes, cursor, header.edges);
+		mapped.to = takeArray<int>(bytes, cursor, header.edges);
+	}
+	// Queries follow the arrays without bounds checks, so every offset and
+	// vertex has to be in range before the mapping is used
+	valid = valid && expected == length
+		&& validOffsets(mapped.out.offset, header.vertices, header.outArcs)
+		&& validOffsets(mapped.in.offset, header.vertices, header.directed ? header.inArcs : header.outArcs)
+		&& validVertices(mapped.out.target, header.outArcs, header.vertices)
+		&& validVertices(mapped.in.target, header.directed ? header.inArcs : 0, header.vertices)
+		&& validVertices(mapped.from, header.edges, header.vertices)
+		&& validVertices(mapped.to, header.edges, header.vertices);
+	if (!valid) {
+		munmap(base, length);
+		std::cerr << "Invalid snapshot file.\n";
+		return false;
+	}
+
+	// Drop whatever the graph held before
+	for (Edge *slab : slabs) {
+		std::free(slab);
+	}
+	slabs.clear();
+	slotCount = 1;
+	storage = CSRStorage();
+	dropLandmarks();
+	hierarchy = Hierarchy();
+	dropHubLabels();
+	unmap();
+	mapping = base;
+	mappingLength = length;
+	csrOnly = true;
+	csr = mapped;
+
+	directed = header.directed;
+	number_of_edges = header.edges;
+	compiled = true;
+	return true;
+}
+
+void Graph::unmap() {
+	if (mapping) {
+		munmap(mapping, mappingLength);
+		mapping = nullptr;
+		mappingLength = 0;
+	}
+}
+
+// Rebuild the edges of a graph that only exists in CSR form so that it can
+// be changed
+void Graph::thaw() {
+	if (!csrOnly) {
+		return;
+	}
+
+	std::vector<int> from(csr.from, csr.from + csr.edges);
+	std::vector<int> to(csr.to, csr.to + csr.edges);
+	std::vector<double> weight(csr.weight, csr.weight + csr.edges);
+	size_t vertices = csr.vertices;
+
+	unmap();
+	storage = CSRStorage();
+	csr = CSR();
+	csrOnly = false;
+	compiled = false;
+	number_of_edges = 0;
+	slotCount = vertices;
+	for (size_t e = 0; e < from.size(); ++e) {
+		addEdge(from[e], to[e], weight[e]);
+	}
+}
+
+// Empty
+bool Graph::empty() {
+	return (vertexSlots() < 2);
+}
+
+// Add an edge
+void Graph::addEdge(int v1, int v2, double weight) {
+	thaw();
+	if (slotCount < 2) {
+		throw("Not enough space");
+	}
+	int node1 = std::min(v1, v2);
+	int node2 = std::max(v1, v2);
+	double weight1 = 0;
+	double weight2 = 0;
+	size_t direction = 0;
+	if (directed) {
+		if (node1 == v1) {
+			weight1 = weight;
+			direction = LEFT;
+		}
+		else {
+			weight2 = weight;
+			direction = RIGHT;
+		}
+	}
+	else {
+		weight1 = weight;
+		weight2 = weight;
+	}
+	// Need to make sure the list can hold largest node
+	for (size_t i = slotCount; i <= (unsigned)std::max(v1,v2); ++i) {
+		addVertex();
+	}
+	// Allocates an Edge from the graph's slabs, where compile finds it
+	allocateEdge(node1, node2, weight1, weight2, direction);
+	number_of_edges++;
+	compiled = false;
+}
 	
-	bool retval = true;
-	//keeps track of which nodes have been visited
-	std::vector<int> visited = std::vector<int>(edgeList.size(), 0);
-	//keeps track of the order in which the nodes are visited
-	std::queue<int> order;
-	//check if tree is connected and acyclic	
-	treeHelper(1, visited);			
-	for (size_t i = 1; i < visited.size(); i++) {
-		if (visited[i] != 1) {
-			retval = false;
+// Add a vertex
+void Graph::addVertex() {
+	thaw();
+	// Vertices are only numbers, so all we need is one more slot
+	++slotCount;
+	compiled = false;
+}
+
+// Freeze the added edges into contiguous CSR arrays
+void Graph::compile() {
+	// A graph loaded straight into CSR form is already frozen
+	if (csrOnly) {
+		return;
+	}
+
+	size_t vertices = slotCount;
+	storage = CSRStorage();
+
+	// Every edge once; a directed edge is stored the way it points
+	storage.from.reserve(number_of_edges);
+	storage.to.reserve(number_of_edges);
+	storage.weight.reserve(number_of_edges);
+	forEachEdge([&](const Edge &e) {
+		bool reversed = directed && e.direction == RIGHT;
+		storage.from.push_back(e.vertex[reversed ? RIGHT : LEFT]);
+		storage.to.push_back(e.vertex[reversed ? LEFT : RIGHT]);
+		storage.weight.push_back(e.weight[reversed ? RIGHT : LEFT]);
+	});
+
+	buildCSR(vertices);
+}
+
+// Build the adjacency arrays for the edges in storage and point csr at them
+void Graph::buildCSR(size_t vertices) {
+	dropLandmarks();
+	hierarchy = Hierarchy();
+	dropHubLabels();
+	// An undirected edge can be followed from either end
+	std::vector<int> tail(storage.from);
+	std::vector<int> head(storage.to);
+	std::vector<double> cost(storage.weight);
+	if (!directed) {
+		tail.insert(tail.end(), storage.to.begin(), storage.to.end());
+		head.insert(head.end(), storage.from.begin(), storage.from.end());
+		cost.insert(cost.end(), storage.weight.begin(), storage.weight.end());
+	}
+
+	csr.vertices = vertices;
+	csr.edges = storage.weight.size();
+	csr.out = buildAdjacency(storage.out, vertices, tail, head, cost, threads);
+	csr.in = directed ? buildAdjacency(storage.in, vertices, head, tail, cost, threads) : csr.out;
+	csr.from = storage.from.data();
+	csr.to = storage.to.data();
+	csr.weight = storage.weight.data();
+	compiled = true;
+}
+
+// Lay out arcs tail -> head as CSR, with every neighbor range sorted by
+// vertex and parallel arcs kept in the order they were given
+Graph::Adjacency Graph::buildAdjacency(AdjacencyStorage &adj, size_t vertices, const std::vector<int> &tail,
+		const std::vector<int> &head, const std::vector<double> &cost, unsigned threads) {
+	size_t arcs = tail.size();
+	adj.offset.assign(vertices + 1, 0);
+	adj.target.resize(arcs);
+	adj.weight.resize(arcs);
+
+	if (threads <= 1 || arcs < (1 << 16)) {
+		// Bucket by head first and then stably by tail, so the ranges come
+		// out sorted without a comparison sort
+		std::vector<size_t> bucket(vertices + 1, 0);
+		for (size_t i = 0; i < arcs; ++i) {
+			++bucket[head[i] + 1];
+		}
+		for (size_t v = 1; v <= vertices; ++v) {
+			bucket[v] += bucket[v - 1];
+		}
+		std::vector<size_t> byHead(arcs);
+		for (size_t i = 0; i < arcs; ++i) {
+			byHead[bucket[head[i]]++] = i;
+		}
+
+		for (size_t i = 0; i < arcs; ++i) {
+			++adj.offset[tail[i] + 1];
+		}
+		for (size_t v = 1; v <= vertices; ++v) {
+			adj.offset[v] += adj.offset[v - 1];
+		}
+
+		std::vector<size_t> next(adj.offset.begin(), adj.offset.end() - 1);
+		for (size_t i : byHead) {
+			size_t slot = next[tail[i]]++;
+			adj.target[slot] = head[i];
+			adj.weight[slot] = cost[i];
+		}
+	} else {
+		// Count degrees and scatter arc numbers into their ranges with
+		// atomic cursors, then sort each range on its own
+		std::vector<std::atomic<size_t>> cursor(vertices + 1);
+		parallelFor(vertices + 1, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				cursor[v].store(0, std::memory_order_relaxed);
+			}
+		});
+		parallelFor(arcs, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				cursor[tail[i]].fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+		parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				adj.offset[v] = cursor[v].load(std::memory_order_relaxed);
+			}
+		});
+		adj.offset[vertices] = 0;
+		parallelPrefixSum(adj.offset, threads);
+		parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				cursor[v].store(adj.offset[v], std::memory_order_relaxed);
+			}
+		});
+
+		std::vector<size_t> order(arcs);
+		parallelFor(arcs, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				order[cursor[tail[i]].fetch_add(1, std::memory_order_relaxed)] = i;
+			}
+		});
+		parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				std::sort(order.begin() + adj.offset[v], order.begin() + adj.offset[v + 1],
+					[&](size_t a, size_t b) {
+						return head[a] < head[b] || (head[a] == head[b] && a < b);
+					});
+				for (size_t slot = adj.offset[v]; slot < adj.offset[v + 1]; ++slot) {
+					adj.target[slot] = head[order[slot]];
+					adj.weight[slot] = cost[order[slot]];
+				}
+			}
+		});
+	}
+
+	Adjacency view = { adj.offset.data(), adj.target.data(), adj.weight.data() };
+	return view;
+}
+
+size_t Graph::vertexSlots() const {
+	return csrOnly ? csr.vertices : slotCount;
+}
+
+const Graph::CSR &Graph::frozen() {
+	if (!compiled) {
+		compile();
+	}
+	return csr;
+}
+
+// Number of arcs a search can follow out of node
+size_t Graph::degree(int node, bool ignoreDirections) const {
+	size_t arcs = csr.out.offset[node + 1] - csr.out.offset[node];
+	if (directed && ignoreDirections) {
+		arcs += csr.in.offset[node + 1] - csr.in.offset[node];
+	}
+	return arcs;
+}
+
+// Number of arcs a search can follow in the whole graph
+size_t Graph::arcCount(bool ignoreDirections) const {
+	size_t arcs = csr.out.offset[csr.vertices];
+	if (directed && ignoreDirections) {
+		arcs += csr.in.offset[csr.vertices];
+	}
+	return arcs;
+}
+
+// Direction-optimizing breadth first search from source over the vertices
+// not yet marked in ws (Beamer, Asanovic and Patterson). While the frontier
+// is small each level is grown top-down from it; once its arcs outweigh the
+// unexplored ones, every unvisited vertex instead looks for a parent in the
+// frontier, bottom-up, until the frontier shrinks again. Large levels are
+// split across the graph's threads. Bottom-up levels come out in vertex
+// order, and top-down levels in the order one thread would find them.
+// Each level is passed to onLevel with its depth,
+// and the search stops when onLevel returns true. unexploredArcs carries the
+// arcs of unvisited vertices between searches over the same workspace.
+template <typename F>
+void Graph::levelSearch(Workspace &ws, int source, bool ignoreDirections, size_t &unexploredArcs, F onLevel) const {
+	std::vector<int> &frontier = ws.queue;
+	std::vector<int> &next = ws.next;
+	frontier.clear();
+	frontier.push_back(source);
+	ws.visit(source);
+	size_t frontierArcs = degree(source, ignoreDirections);
+	unexploredArcs -= frontierArcs;
+
+	// Arcs that lead into a vertex, for the bottom-up checks
+	const Adjacency &parents = directed && !ignoreDirections ? csr.in : csr.out;
+	const bool bothWays = directed && ignoreDirections;
+	auto hasParentIn = [&](const Adjacency &adj, size_t v) {
+		for (size_t a = adj.offset[v]; a < adj.offset[v + 1]; ++a) {
+			if (ws.inFrontier(adj.target[a])) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	bool bottomUp = false;
+	size_t previousSize = 0;
+	for (int depth = 0; !frontier.empty(); ++depth) {
+		if (onLevel(frontier, depth)) {
+			return;
+		}
+
+		bool growing = frontier.size() > previousSize;
+		if (!bottomUp) {
+			bottomUp = csr.vertices >= BOTTOM_UP_MIN_VERTICES && growing
+				&& frontierArcs > unexploredArcs / BOTTOM_UP_ALPHA
+				&& frontier.size() >= csr.vertices / TOP_DOWN_BETA;
+		} else {
+			bottomUp = growing || frontier.size() >= csr.vertices / TOP_DOWN_BETA;
+		}
+		previousSize = frontier.size();
+
+		next.clear();
+		if (!bottomUp) {
+			unsigned workers = frontierArcs >= PARALLEL_LEVEL_MIN_WORK ? threads : 1;
+			frontierArcs = 0;
+			if (workers == 1) {
+				for (int node : frontier) {
+					forEachNeighbor(node, ignoreDirections, [&](int v) {
+						if (ws.visit(v)) {
+							next.push_back(v);
+							frontierArcs += degree(v, ignoreDirections);
+						}
+					});
+				}
+			} else {
+				// Each new vertex joins the level from the first frontier
+				// vertex that reaches it, as on one thread. The threads
+				// first settle every neighbor's lowest frontier position
+				// by atomic minimum, then each lists, in arc order, the
+				// unvisited vertices its own slice of the frontier won.
+				// Positions carry the level's stamp, so older ones count
+				// as unset. Visited vertices are left to the claim, which
+				// is cheaper than checking them in the first pass.
+				if (ws.owner.size() < csr.vertices) {
+					ws.owner.resize(csr.vertices, 0);
+				}
+				if (++ws.ownerStamp == 0) {
+					std::fill(ws.owner.begin(), ws.owner.end(), 0);
+					ws.ownerStamp = 1;
+				}
+				const std::uint64_t stamp = std::uint64_t(ws.ownerStamp) << 32;
+				parallelFor(frontier.size(), workers, [&](unsigned, size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i) {
+						std::uint64_t position = stamp | i;
+						forEachNeighbor(frontier[i], ignoreDirections, [&](int v) {
+							std::uint64_t *owner = &ws.owner[v];
+							std::uint64_t current = __atomic_load_n(owner, __ATOMIC_RELAXED);
+							while ((current < stamp || current > position)
+									&& !__atomic_compare_exchange_n(owner, &current, position, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+							}
+						});
+					}
+				});
+				frontierArcs = parallelLevel(ws, frontier.size(), workers, next, [&](std::vector<int> &piece, size_t begin, size_t end) {
+					size_t arcs = 0;
+					for (size_t i = begin; i < end; ++i) {
+						std::uint64_t position = stamp | i;
+						forEachNeighbor(frontier[i], ignoreDirections, [&](int v) {
+							if (__atomic_load_n(&ws.owner[v], __ATOMIC_RELAXED) == position && ws.claim(v)) {
+								piece.push_back(v);
+								arcs += degree(v, ignoreDirections);
+							}
+						});
+					}
+					return arcs;
+				});
+			}
+		} else {
+			for (int node : frontier) {
+				ws.setFrontier(node, true);
+			}
+			// Every vertex is only ever marked by the thread whose range
+			// holds it, and pieces join in range order, so the level is in
+			// vertex order however many threads scan it
+			unsigned workers = csr.vertices >= PARALLEL_LEVEL_MIN_WORK ? threads : 1;
+			frontierArcs = parallelLevel(ws, csr.vertices - 1, workers, next, [&](std::vector<int> &piece, size_t begin, size_t end) {
+				size_t arcs = 0;
+				for (size_t v = begin + 1; v <= end; ++v) {
+					if (!ws.visited(v) && (hasParentIn(parents, v) || (bothWays && hasParentIn(csr.in, v)))) {
+						ws.visit(v);
+						piece.push_back(v);
+						arcs += degree(v, ignoreDirections);
+					}
+				}
+				return arcs;
+			});
+			for (int node : frontier) {
+				ws.setFrontier(node, false);
+			}
+		}
+		unexploredArcs -= frontierArcs;
+		frontier.swap(next);
+	}
+}
+
+// Build one search level on the given number of threads. expand(piece,
+// begin, end) scans items [begin, end) of the level's work into piece and
+// returns the arcs of the vertices it added; the pieces are joined into next
+// in thread order and the arcs summed. A single thread writes straight into
+// next.
+template <typename F>
+size_t Graph::parallelLevel(Workspace &ws, size_t work, unsigned workers, std::vector<int> &next, F expand) const {
+	if (workers <= 1) {
+		return expand(next, 0, work);
+	}
+	if (ws.pieces.size() < workers) {
+		ws.pieces.resize(workers);
+	}
+	std::vector<size_t> arcs(workers, 0);
+	parallelFor(work, workers, [&](unsigned t, size_t begin, size_t end) {
+		ws.pieces[t].clear();
+		arcs[t] = expand(ws.pieces[t], begin, end);
+	});
+	size_t total = 0;
+	for (unsigned t = 0; t < workers; ++t) {
+		next.insert(next.end(), ws.pieces[t].begin(), ws.pieces[t].end());
+		ws.pieces[t].clear();
+		total += arcs[t];
+	}
+	return total;
+}
+
+// Call visit on every vertex reachable over one edge from node. With
+// ignoreDirections, directed edges are followed both ways.
+template <typename F>
+void Graph::forEachNeighbor(int node, bool ignoreDirections, F visit) const {
+	for (size_t i = csr.out.offset[node]; i < csr.out.offset[node + 1]; ++i) {
+		visit(csr.out.target[i]);
+	}
+	if (directed && ignoreDirections) {
+		for (size_t i = csr.in.offset[node]; i < csr.in.offset[node + 1]; ++i) {
+			visit(csr.in.target[i]);
+		}
+	}
+}
+		
+int Graph::numConnectedComponents() {
+	const CSR &graph = frozen();
+	std::vector<int> root = componentRoots();
+	size_t components = 0;
+	for (size_t v = 1; v < graph.vertices; ++v) {
+		components += root[v] == (int)v;
+	}
+	return components;
+}
+
+std::vector<int> Graph::components(std::vector<int> &sizes) {
+	frozen();
+	std::vector<int> id = componentRoots();
+	numberComponents(id, sizes);
+	return id;
+}
+
+// Connected components engine: for every vertex, a vertex that stands for
+// its whole component. One thread joins the ends of every edge in a
+// union-find. More threads run Afforest (Sutton, Ben-Nun and Barak): link
+// each vertex to its first few neighbors, guess the biggest component from
+// a sample, and then link the remaining arcs of only the vertices outside
+// it. Links hook the higher of two roots onto the lower with a compare-and-
+// swap, as in Shiloach-Vishkin.
+std::vector<int> Graph::componentRoots() const {
+	const size_t vertices = csr.vertices;
+	std::vector<int> root(vertices);
+	if (threads == 1 || arcCount(true) < (1 << 16)) {
+		DisjointSets sets(vertices);
+		for (size_t e = 0; e < csr.edges; ++e) {
+			sets.join(csr.from[e], csr.to[e]);
+		}
+		for (size_t v = 0; v < vertices; ++v) {
+			root[v] = sets.find(v);
+		}
+		return root;
+	}
+
+	std::vector<std::atomic<int>> parent(vertices);
+	parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+		for (size_t v = begin; v < end; ++v) {
+			parent[v].store(v, std::memory_order_relaxed);
+		}
+	});
+	auto link = [&](int u, int v) {
+		int p1 = parent[u].load(std::memory_order_relaxed);
+		int p2 = parent[v].load(std::memory_order_relaxed);
+		while (p1 != p2) {
+			int high = std::max(p1, p2);
+			int low = std::min(p1, p2);
+			int expected = high;
+			if (parent[high].compare_exchange_strong(expected, low, std::memory_order_relaxed) || expected == low) {
+				break;
+			}
+			p1 = parent[expected].load(std::memory_order_relaxed);
+			p2 = parent[low].load(std::memory_order_relaxed);
+		}
+	};
+	auto compress = [&]() {
+		parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				int p = parent[v].load(std::memory_order_relaxed);
+				while (parent[p].load(std::memory_order_relaxed) != p) {
+					p = parent[p].load(std::memory_order_relaxed);
+				}
+				parent[v].store(p, std::memory_order_relaxed);
+			}
+		});
+	};
+	// The i-th arc of v, out arcs first, directed edges both ways
+	const bool bothWays = directed;
+	auto neighbor = [&](size_t v, size_t i) {
+		size_t out = csr.out.offset[v + 1] - csr.out.offset[v];
+		return i < out ? csr.out.target[csr.out.offset[v] + i] : csr.in.target[csr.in.offset[v] + i - out];
+	};
+
+	for (size_t round = 0; round < AFFOREST_ROUNDS; ++round) {
+		parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				if (degree(v, bothWays) > round) {
+					link(v, neighbor(v, round));
+				}
+			}
+		});
+		compress();
+	}
+
+	std::mt19937 random(vertices);
+	std::vector<int> sample(AFFOREST_SAMPLES);
+	for (int &s : sample) {
+		s = parent[random() % vertices].load(std::memory_order_relaxed);
+	}
+	std::sort(sample.begin(), sample.end());
+	int biggest = sample[0];
+	size_t run = 0, longest = 0;
+	for (size_t i = 0; i < sample.size(); ++i) {
+		run = i > 0 && sample[i] == sample[i - 1] ? run + 1 : 1;
+		if (run > longest) {
+			longest = run;
+			biggest = sample[i];
+		}
+	}
+
+	// Every edge with an end outside the biggest component is an arc of
+	// that end, so the vertices inside it can be skipped
+	parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+		for (size_t v = begin; v < end; ++v) {
+			if (parent[v].load(std::memory_order_relaxed) == biggest) {
+				continue;
+			}
+			for (size_t i = AFFOREST_ROUNDS; i < degree(v, bothWays); ++i) {
+				link(v, neighbor(v, i));
+			}
+		}
+	});
+	compress();
+
+	parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+		for (size_t v = begin; v < end; ++v) {
+			root[v] = parent[v].load(std::memory_order_relaxed);
+		}
+	});
+	return root;
+}
+
+std::vector<int> Graph::strongComponents(std::vector<int> &sizes) {
+	frozen();
+	std::vector<int> id = strongRoots();
+	numberComponents(id, sizes);
+	return id;
+}
+
+// Strongly connected components engine: for every vertex, a vertex of its
+// component. With several threads the big components go first, forward-
+// backward style (Fleischer, Hendrickson and Pinar): vertices with no arc
+// in or none out among those left are components by themselves (trimming),
+// and the component of the pivot most likely in the giant component is the
+// part of its forward reach that reaches it back. Both searches run level
+// by level on all threads. Whatever is left, or everything on one thread,
+// goes to Pearce's iterative version of Tarjan's algorithm.
+std::vector<int> Graph::strongRoots() {
+	const size_t vertices = csr.vertices;
+	std::vector<int> root(vertices, -1);
+	if (threads > 1 && arcCount(false) >= (1 << 16)) {
+		trimSingletons(root);
+		// The pivot with the most arcs in and out
+		int pivot = -1;
+		size_t best = 0;
+		for (size_t v = 0; v < vertices; ++v) {
+			size_t out = csr.out.offset[v + 1] - csr.out.offset[v];
+			size_t in = csr.in.offset[v + 1] - csr.in.offset[v];
+			if (root[v] < 0 && out * in >= best) {
+				pivot = v;
+				best = out * in;
+			}
+		}
+		if (pivot >= 0) {
+			WorkspaceLease ws(*this);
+			ws->begin(vertices);
+			parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+				for (size_t v = begin; v < end; ++v) {
+					if (root[v] >= 0) {
+						ws->visit(v);
+					}
+				}
+			});
+			reachAll(*ws, pivot, csr.out);
+			// Search back within the forward reach only
+			const unsigned forward = ws->epoch;
+			ws->begin(vertices);
+			parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+				for (size_t v = begin; v < end; ++v) {
+					if (ws->mark[v] != forward || root[v] >= 0) {
+						ws->visit(v);
+					}
+				}
+			});
+			for (int v : reachAll(*ws, pivot, csr.in)) {
+				root[v] = pivot;
+			}
+			trimSingletons(root);
+		}
+	}
+
+	// Pearce: rindex is the discovery index of a vertex on the search path
+	// or the stack, lowered to the least one it reaches, until its
+	// component is done; then it is a component number, counting down from
+	// vertices, that stays above every live index.
+	std::vector<int> rindex(vertices, 0);
+	std::vector<bool> isRoot(vertices, false);
+	std::vector<int> stack;
+	std::vector<std::pair<int, size_t>> path;
+	int index = 1;
+	int component = vertices;
+	for (size_t source = 0; source < vertices; ++source) {
+		if (root[source] >= 0 || rindex[source] != 0) {
+			continue;
+		}
+		rindex[source] = index++;
+		isRoot[source] = true;
+		path.push_back(std::make_pair(int(source), size_t(0)));
+		while (!path.empty()) {
+			int v = path.back().first;
+			size_t &tried = path.back().second;
+			if (csr.out.offset[v] + tried < csr.out.offset[v + 1]) {
+				int w = csr.out.target[csr.out.offset[v] + tried];
+				++tried;
+				if (rindex[w] == 0 && root[w] < 0) {
+					rindex[w] = index++;
+					isRoot[w] = true;
+					path.push_back(std::make_pair(w, size_t(0)));
+				} else if (rindex[w] != 0 && rindex[w] < rindex[v]) {
+					rindex[v] = rindex[w];
+					isRoot[v] = false;
+				}
+				continue;
+			}
+
+			path.pop_back();
+			if (isRoot[v]) {
+				--index;
+				while (!stack.empty() && rindex[v] <= rindex[stack.back()]) {
+					int w = stack.back();
+					stack.pop_back();
+					rindex[w] = component;
+					root[w] = v;
+					--index;
+				}
+				rindex[v] = component--;
+				root[v] = v;
+			} else {
+				stack.push_back(v);
+			}
+			if (!path.empty()) {
+				int u = path.back().first;
+				if (rindex[v] < rindex[u]) {
+					rindex[u] = rindex[v];
+					isRoot[u] = false;
+				}
+			}
+		}
+	}
+	return root;
+}
+
+// Make every vertex not yet in a component, with no arc in or no arc out to
+// another such vertex, a component by itself. Two rounds catch the chains
+// that peel off once their ends are gone.
+void Graph::trimSingletons(std::vector<int> &root) const {
+	const size_t vertices = csr.vertices;
+	std::vector<char> alone(vertices, 0);
+	auto linked = [&](const Adjacency &adj, size_t v) {
+		for (size_t a = adj.offset[v]; a < adj.offset[v + 1]; ++a) {
+			int w = adj.target[a];
+			if (w != (int)v && root[w] < 0) {
+				return true;
+			}
+		}
+		return false;
+	};
+	for (int round = 0; round < 2; ++round) {
+		parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				alone[v] = root[v] < 0 && (!linked(csr.out, v) || !linked(csr.in, v));
+			}
+		});
+		parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				if (alone[v]) {
+					root[v] = v;
+				}
+			}
+		});
+	}
+}
+
+// All vertices reachable from source over adj that are not marked in ws,
+// marking them; each level is split across the graph's threads once it is
+// big enough
+std::vector<int> Graph::reachAll(Workspace &ws, int source, const Adjacency &adj) const {
+	std::vector<int> reached(1, source);
+	ws.visit(source);
+	for (size_t begin = 0; begin < reached.size();) {
+		size_t end = reached.size();
+		size_t arcs = 0;
+		for (size_t i = begin; i < end; ++i) {
+			arcs += adj.offset[reached[i] + 1] - adj.offset[reached[i]];
+		}
+		ws.next.clear();
+		parallelLevel(ws, end - begin, arcs >= PARALLEL_LEVEL_MIN_WORK ? threads : 1, ws.next,
+				[&](std::vector<int> &piece, size_t first, size_t last) {
+			for (size_t i = begin + first; i < begin + last; ++i) {
+				for (size_t a = adj.offset[reached[i]]; a < adj.offset[reached[i] + 1]; ++a) {
+					if (ws.claim(adj.target[a])) {
+						piece.push_back(adj.target[a]);
+					}
+				}
+			}
+			return size_t(0);
+		});
+		reached.insert(reached.end(), ws.next.begin(), ws.next.end());
+		begin = end;
+	}
+	return reached;
+}
+
+// Tree check
+bool Graph::tree() {
+	std::vector<int> roots;
+	return checkForest(roots, 1) && roots.size() == 1;
+}
+
+// Forest check
+bool Graph::forest(std::vector<int> &roots) {
+	return checkForest(roots, std::numeric_limits<size_t>::max());
+}
+
+// Decide whether the graph is a forest in one depth first pass over it,
+// giving up as soon as it has more than maxRoots trees. Undirected, k
+// components make a forest exactly when there are nodes - k edges.
+// Directed, every node needs at most one edge in; the nodes with none are
+// the roots, and the rest are on cycles unless a search from the roots
+// reaches them.
+bool Graph::checkForest(std::vector<int> &roots, size_t maxRoots) {
+	roots.clear();
+	const CSR &graph = frozen();
+	const size_t nodes = graph.vertices > 0 ? graph.vertices - 1 : 0;
+	if (maxRoots == 1 && graph.edges + 1 != nodes) {
+		return false;
+	}
+	if (graph.edges >= std::max<size_t>(nodes, 1)) {
+		return false;
+	}
+
+	WorkspaceLease ws(*this);
+	ws->begin(graph.vertices);
+	size_t reached = 0;
+	auto count = [&](int) {
+		++reached;
+	};
+	if (directed) {
+		for (size_t v = 1; v < graph.vertices; ++v) {
+			size_t in = graph.in.offset[v + 1] - graph.in.offset[v];
+			if (in > 1) {
+				return false;
+			}
+			if (in == 0) {
+				roots.push_back(v);
+				if (roots.size() > maxRoots) {
+					return false;
+				}
+			}
+		}
+		for (int root : roots) {
+			depthSearch(*ws, root, false, count);
+		}
+		return reached == nodes;
+	}
+
+	for (size_t v = 1; v < graph.vertices; ++v) {
+		if (!ws->visited(v)) {
+			roots.push_back(v);
+			if (roots.size() > maxRoots) {
+				return false;
+			}
+			depthSearch(*ws, v, true, count);
+		}
+	}
+	return graph.edges == nodes - roots.size();
+}
+
+// Depth First Traverse - proceed from source
+void Graph::DFT(int source, std::string file) {
+	const CSR &graph = frozen();
+	// keeps track of which nodes have been visited
+	WorkspaceLease ws(*this);
+	ws->begin(graph.vertices);
+	// keeps track of the order in which the nodes are visited
+	std::vector<int> &order = ws->queue;
+	depthSearch(*ws, source, false, [&](int node) {
+		order.push_back(node);
+	});
+	// print results to file
+	std::ofstream outfile(file, std::ofstream::out);
+	if (outfile.is_open()) {
+		for (int node : order) {
+			outfile << node << "\n";
+		}
+		outfile.close();
+	} else {
+		std::cerr << "Could not open input file.\n";
+	}
+}
+
+// Depth first search from source over the vertices not yet marked in ws,
+// calling onFinish on each vertex once all of its neighbors are done (post-
+// order). The path is kept on ws.stack with how far each vertex is through
+// its arcs, so a search resumes each vertex where it left off and deep
+// graphs cannot overflow the call stack. Neighbors are tried in adjacency
+// order: out arcs, then with ignoreDirections, in arcs. Undirected edges
+// appear in the out adjacency of both ends, so this covers both graph types.
+template <typename F>
+void Graph::depthSearch(Workspace &ws, int source, bool ignoreDirections, F onFinish) const {
+	const bool bothWays = directed && ignoreDirections;
+	std::vector<std::pair<int, size_t>> &stack = ws.stack;
+	ws.visit(source);
+	stack.push_back(std::make_pair(source, size_t(0)));
+	while (!stack.empty()) {
+		int node = stack.back().first;
+		size_t &tried = stack.back().second;
+		size_t out = csr.out.offset[node + 1] - csr.out.offset[node];
+		size_t arcs = bothWays ? out + csr.in.offset[node + 1] - csr.in.offset[node] : out;
+
+		int next = -1;
+		while (tried < arcs && next < 0) {
+			int v = tried < out ? csr.out.target[csr.out.offset[node] + tried]
+					: csr.in.target[csr.in.offset[node] + tried - out];
+			++tried;
+			if (ws.visit(v)) {
+				next = v;
+			}
+		}
+		if (next < 0) {
+			stack.pop_back();
+			onFinish(node);
+		} else {
+			stack.push_back(std::make_pair(next, size_t(0)));
+		}
+	}
+}
+
+void Graph::BFT(int source, std::string file) {
+	const CSR &graph = frozen();
+	std::ofstream outfile(file);
+	if (!outfile) {
+		return;
+	}
+
+	WorkspaceLease ws(*this);
+	ws->begin(graph.vertices);
+	size_t unexploredArcs = arcCount(!directed);
+	levelSearch(*ws, source, !directed, unexploredArcs, [&](const std::vector<int> &level, int) {
+		for (int node : level) {
+			outfile << node << "\n";
+		}
+		return false;
+	});
+}
+// Closeness - determine minimum number of edges to get
+// from one node to the other
+int Graph::closeness(int v1, int v2) {
+	frozen();
+	WorkspaceLease ws(*this);
+	return hopDistance(v1, v2, *ws);
+}
+
+// Closeness for a batch of vertex pairs, split across the graph's threads
+// with a workspace each
+std::vector<int> Graph::closeness(const std::vector<std::pair<int, int>> &pairs) {
+	frozen();
+	std::vector<int> distances(pairs.size());
+	parallelFor(pairs.size(), threads, [&](unsigned, size_t begin, size_t end) {
+		WorkspaceLease ws(*this);
+		for (size_t i = begin; i < end; ++i) {
+			distances[i] = hopDistance(pairs[i].first, pairs[i].second, *ws);
+		}
+	});
+	return distances;
+}
+
+// Bidirectional breadth first search: grow a frontier forward from v1 and
+// one backward from v2 (over edges into each vertex), always extending the
+// one with fewer edges to scan. Before a level is extended no vertex is
+// reached from both ends, so the shortest path is longer than both depths
+// together, and the first vertex that joins the two searches ends it.
+int Graph::hopDistance(int v1, int v2, Workspace &ws) const {
+	if(v1 == v2){
+		return 0;
+	}
+	if (v1 < 1 || v2 < 1 || (size_t)std::max(v1, v2) >= csr.vertices) {
+		return -1;
+	}
+	if (hubLabels.vertices) {
+		return labelDistance(v1, v2);
+	}
+
+	ws.begin(csr.vertices);
+	const unsigned forwardMark = ws.epoch;
+	const unsigned backwardMark = ws.epoch + 1;
+	std::vector<int> &forward = ws.queue;
+	std::vector<int> &backward = ws.backQueue;
+	forward.push_back(v1);
+	ws.mark[v1] = forwardMark;
+	backward.push_back(v2);
+	ws.mark[v2] = backwardMark;
+
+	int depth = 0;
+	while (!forward.empty() && !backward.empty()) {
+		bool fromSource = frontierArcs(forward, csr.out) <= frontierArcs(backward, csr.in);
+		std::vector<int> &frontier = fromSource ? forward : backward;
+		const Adjacency &adj = fromSource ? csr.out : csr.in;
+		const unsigned own = fromSource ? forwardMark : backwardMark;
+		const unsigned other = fromSource ? backwardMark : forwardMark;
+
+		ws.next.clear();
+		for (int node : frontier) {
+			for (size_t a = adj.offset[node]; a < adj.offset[node + 1]; ++a) {
+				int next = adj.target[a];
+				if (ws.mark[next] == other) {
+					return depth + 1;
+				}
+				if (ws.mark[next] != own) {
+					ws.mark[next] = own;
+					ws.next.push_back(next);
+				}
+			}
+		}
+		frontier.swap(ws.next);
+		++depth;
+	}
+	return -1;
+}
+
+// Multi-source breadth first search (Then et al.): up to 64 searches, one
+// per source, run as one, with a bit per search in each vertex's words. A
+// vertex that several searches reach at the same depth has its arcs scanned
+// once for all of them. onReach(node, searches, depth) gets every node with
+// the bits of the searches first reaching it at that depth. The searches
+// follow edges the way closeness does and stop after maxDepth levels.
+template <typename F>
+void Graph::multiSourceSearch(Workspace &ws, const int *sources, size_t count, int maxDepth, F onReach) const {
+	ws.begin(csr.vertices);
+	if (ws.seenBy.size() < csr.vertices) {
+		ws.seenBy.resize(csr.vertices, 0);
+		ws.frontierBy.resize(csr.vertices, 0);
+		ws.nextBy.resize(csr.vertices, 0);
+	}
+	std::vector<int> &active = ws.queue;
+	std::vector<int> &candidates = ws.next;
+	std::vector<int> &reached = ws.backQueue;
+	for (size_t i = 0; i < count; ++i) {
+		int source = sources[i];
+		if (source < 1 || (size_t)source >= csr.vertices) {
+			continue;
+		}
+		if (!ws.seenBy[source]) {
+			reached.push_back(source);
+			active.push_back(source);
+		}
+		ws.seenBy[source] |= std::uint64_t(1) << i;
+		ws.frontierBy[source] |= std::uint64_t(1) << i;
+	}
+	for (int v : active) {
+		onReach(v, ws.frontierBy[v], 0);
+	}
+
+	// Once the frontier holds a good share of the arcs, a level is built
+	// by every vertex pulling the searches in from its parents instead
+	const Adjacency &parents = directed ? csr.in : csr.out;
+	std::uint64_t everySearch = 0;
+	for (int v : active) {
+		everySearch |= ws.seenBy[v];
+	}
+	size_t frontierArcs = 0;
+	for (int v : active) {
+		frontierArcs += csr.out.offset[v + 1] - csr.out.offset[v];
+	}
+	for (int depth = 1; depth <= maxDepth && !active.empty(); ++depth) {
+		candidates.clear();
+		if (frontierArcs > csr.out.offset[csr.vertices] / BOTTOM_UP_ALPHA) {
+			for (size_t v = 1; v < csr.vertices; ++v) {
+				if (ws.seenBy[v] == everySearch) {
+					continue;
+				}
+				std::uint64_t searches = 0;
+				for (size_t a = parents.offset[v]; a < parents.offset[v + 1]; ++a) {
+					searches |= ws.frontierBy[parents.target[a]];
+				}
+				if (searches & ~ws.seenBy[v]) {
+					ws.nextBy[v] = searches;
+					candidates.push_back(v);
+				}
+			}
+			for (int v : active) {
+				ws.frontierBy[v] = 0;
+			}
+		} else {
+			// Hand each frontier vertex's searches on to its neighbors
+			for (int v : active) {
+				std::uint64_t searches = ws.frontierBy[v];
+				ws.frontierBy[v] = 0;
+				for (size_t a = csr.out.offset[v]; a < csr.out.offset[v + 1]; ++a) {
+					int next = csr.out.target[a];
+					if (!ws.nextBy[next]) {
+						candidates.push_back(next);
+					}
+					ws.nextBy[next] |= searches;
+				}
+			}
+		}
+
+		// Keep the searches that had not reached a vertex before
+		active.clear();
+		frontierArcs = 0;
+		for (int v : candidates) {
+			std::uint64_t fresh = ws.nextBy[v] & ~ws.seenBy[v];
+			ws.nextBy[v] = 0;
+			if (fresh) {
+				if (!ws.seenBy[v]) {
+					reached.push_back(v);
+				}
+				ws.seenBy[v] |= fresh;
+				ws.frontierBy[v] = fresh;
+				active.push_back(v);
+				frontierArcs += csr.out.offset[v + 1] - csr.out.offset[v];
+				onReach(v, fresh, depth);
+			}
+		}
+	}
+
+	for (int v : active) {
+		ws.frontierBy[v] = 0;
+	}
+	for (int v : reached) {
+		ws.seenBy[v] = 0;
+	}
+}
+
+// Run multiSourceSearch over the sources 64 at a time, the batches split
+// across the graph's threads, calling onReach(i, node, depth) when the
+// search from sources[i] first reaches node
+template <typename F>
+void Graph::searchBatches(const std::vector<int> &sources, int maxDepth, F onReach) {
+	frozen();
+	size_t batches = (sources.size() + 63) / 64;
+	parallelFor(batches, threads, [&](unsigned, size_t begin, size_t end) {
+		WorkspaceLease ws(*this);
+		for (size_t batch = begin; batch < end; ++batch) {
+			size_t first = batch * 64;
+			size_t count = std::min<size_t>(64, sources.size() - first);
+			multiSourceSearch(*ws, sources.data() + first, count, maxDepth, [&](int node, std::uint64_t searches, int depth) {
+				while (searches) {
+					int i = __builtin_ctzll(searches);
+					searches &= searches - 1;
+					onReach(first + i, node, depth);
+				}
+			});
+		}
+	});
+}
+
+std::vector<std::vector<int>> Graph::closeness(const std::vector<int> &sources) {
+	const CSR &graph = frozen();
+	std::vector<std::vector<int>> distances(sources.size());
+	for (std::vector<int> &distance : distances) {
+		distance.assign(graph.vertices, -1);
+	}
+	searchBatches(sources, std::numeric_limits<int>::max(), [&](size_t i, int node, int depth) {
+		distances[i][node] = depth;
+	});
+	return distances;
+}
+
+std::vector<std::vector<int>> Graph::stepAway(const std::vector<int> &sources, int closeness) {
+	const CSR &graph = frozen();
+	std::vector<std::vector<int>> nodes(sources.size());
+	if (closeness == -1) {
+		// The nodes a search never reaches, as for a single source
+		std::vector<std::vector<bool>> reached(sources.size());
+		searchBatches(sources, std::numeric_limits<int>::max(), [&](size_t i, int node, int) {
+			if (reached[i].empty()) {
+				reached[i].assign(graph.vertices, false);
+			}
+			reached[i][node] = true;
+		});
+		for (size_t i = 0; i < sources.size(); ++i) {
+			for (size_t v = 1; v < graph.vertices; ++v) {
+				if (reached[i].empty() || !reached[i][v]) {
+					nodes[i].push_back(v);
+				}
+			}
+		}
+		return nodes;
+	}
+	if (closeness > 0) {
+		searchBatches(sources, closeness, [&](size_t i, int node, int depth) {
+			if (depth == closeness) {
+				nodes[i].push_back(node);
+			}
+		});
+		for (std::vector<int> &level : nodes) {
+			std::sort(level.begin(), level.end());
+		}
+	}
+	return nodes;
+}
+
+// Number of arcs leaving a frontier
+size_t Graph::frontierArcs(const std::vector<int> &frontier, const Adjacency &adj) {
+	size_t arcs = 0;
+	for (int node : frontier) {
+		arcs += adj.offset[node + 1] - adj.offset[node];
+	}
+	return arcs;
+}
+
+Graph::WorkspaceLease::WorkspaceLease(Graph &g) : graph(g) {
+	std::lock_guard<std::mutex> lock(graph.workspaceLock);
+	if (graph.idleWorkspaces.empty()) {
+		ws.reset(new Workspace());
+	} else {
+		ws = std::move(graph.idleWorkspaces.back());
+		graph.idleWorkspaces.pop_back();
+	}
+}
+
+Graph::WorkspaceLease::~WorkspaceLease() {
+	std::lock_guard<std::mutex> lock(graph.workspaceLock);
+	graph.idleWorkspaces.push_back(std::move(ws));
+}
+
+// Start a new search over the given number of vertices. Marks from earlier
+// searches expire with the epoch, so only the first search pays for the
+// arrays.
+void Graph::Workspace::begin(size_t vertices) {
+	if (mark.size() < vertices) {
+		mark.resize(vertices, 0);
+	}
+	// Each search owns two stamps, epoch and epoch + 1
+	if (epoch >= std::numeric_limits<unsigned>::max() - 2) {
+		std::fill(mark.begin(), mark.end(), 0);
+		epoch = 0;
+	}
+	if (frontier.size() < (vertices + 63) / 64) {
+		frontier.resize((vertices + 63) / 64, 0);
+	}
+	epoch += 2;
+	queue.clear();
+	backQueue.clear();
+	next.clear();
+}
+
+// Shortest paths - Dijkstra's algorithm over a radix heap. A vertex is done
+// the first time it comes off the heap, and later copies of it are skipped.
+bool Graph::shortestPaths(int source, std::vector<double> &distance, std::vector<int> &predecessor, int target) {
+	return dijkstra(frozen().out, source, distance, predecessor, target);
+}
+
+// Dijkstra along adj, which runs against the edges when it is the in arcs
+bool Graph::dijkstra(const Adjacency &adj, int source, std::vector<double> &distance, std::vector<int> &predecessor,
+		int target) {
+	const CSR &graph = frozen();
+	distance.assign(graph.vertices, std::numeric_limits<double>::infinity());
+	predecessor.assign(graph.vertices, -1);
+	if (source < 1 || (size_t)source >= graph.vertices) {
+		return true;
+	}
+
+	WorkspaceLease ws(*this);
+	ws->begin(graph.vertices);
+	RadixHeap heap;
+	distance[source] = 0;
+	heap.push(0, source);
+	while (!heap.empty()) {
+		int node = heap.pop();
+		if (!ws->visit(node)) {
+			continue;
+		}
+		if (node == target) {
+			break;
+		}
+		for (size_t a = adj.offset[node]; a < adj.offset[node + 1]; ++a) {
+			double weight = adj.weight[a];
+			if (weight < 0) {
+				std::cerr << "Negative edge weight.\n";
+				return false;
+			}
+			int next = adj.target[a];
+			if (distance[node] + weight < distance[next]) {
+				distance[next] = distance[node] + weight;
+				predecessor[next] = node;
+				heap.push(distance[next], next);
+			}
+		}
+	}
+	return true;
+}
+
+// Delta-stepping (Meyer and Sanders). Tentative distances fall by atomic
+// minimum and are filed in buckets delta wide. The lowest bucket is emptied
+// in rounds: its vertices relax their light arcs on all threads, and any
+// vertex lowered into the same bucket makes up the next round. Then the
+// vertices it held relax their heavy arcs once, and the next bucket starts.
+// Predecessors are picked afterwards, along the arcs a shortest path can
+// take, by a level search from the source.
+bool Graph::shortestPathsParallel(int source, std::vector<double> &distance, std::vector<int> &predecessor,
+		double delta) {
+	const CSR &graph = frozen();
+	const size_t vertices = graph.vertices;
+	const double infinity = std::numeric_limits<double>::infinity();
+	distance.assign(vertices, infinity);
+	predecessor.assign(vertices, -1);
+	if (source < 1 || (size_t)source >= vertices) {
+		return true;
+	}
+	if (delta <= 0) {
+		delta = tuneDelta();
+	}
+
+	// Nonnegative doubles order like their bits, so an atomic minimum on
+	// the bits lowers the distance
+	auto bitsOf = [](double d) {
+		std::uint64_t bits;
+		std::memcpy(&bits, &d, sizeof(bits));
+		return bits;
+	};
+	auto valueOf = [](std::uint64_t bits) {
+		double d;
+		std::memcpy(&d, &bits, sizeof(d));
+		return d;
+	};
+	std::vector<std::atomic<std::uint64_t>> tentative(vertices);
+	parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+		for (size_t v = begin; v < end; ++v) {
+			tentative[v].store(bitsOf(infinity), std::memory_order_relaxed);
+		}
+	});
+	auto lower = [&](int v, double d) {
+		std::uint64_t bits = bitsOf(d);
+		std::uint64_t current = tentative[v].load(std::memory_order_relaxed);
+		while (bits < current) {
+			if (tentative[v].compare_exchange_weak(current, bits, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	};
+	auto tentativeOf = [&](int v) {
+		return valueOf(tentative[v].load(std::memory_order_relaxed));
+	};
+	// Distances past the last bucket number share it, and it is simply
+	// emptied again for as long as heavy arcs lead back into it
+	const double lastBucket = 9.2e18;
+	auto bucketOf = [&](double d) {
+		double index = d / delta;
+		return index < lastBucket ? std::uint64_t(index) : std::uint64_t(lastBucket);
+	};
+
+	std::atomic<bool> negative(false);
+	// Relax the light or the heavy arcs of node, keeping the vertices
+	// lowered into bucket (once each, by the workspace marks) apart from
+	// the rest
+	auto relax = [&](Workspace &ws, int node, bool heavy, std::uint64_t bucket, std::vector<int> &same, std::vector<int> &later) {
+		double from = tentativeOf(node);
+		for (size_t a = graph.out.offset[node]; a < graph.out.offset[node + 1]; ++a) {
+			double weight = graph.out.weight[a];
+			if (weight < 0) {
+				negative.store(true, std::memory_order_relaxed);
+				continue;
+			}
+			if ((weight > delta) != heavy) {
+				continue;
+			}
+			int next = graph.out.target[a];
+			if (lower(next, from + weight)) {
+				if (bucketOf(from + weight) == bucket) {
+					if (ws.claim(next)) {
+						same.push_back(next);
+					}
+				} else {
+					later.push_back(next);
+				}
+			}
+		}
+	};
+
+	WorkspaceLease ws(*this);
+	if (ws->pieces.size() < threads) {
+		ws->pieces.resize(threads);
+	}
+	std::vector<std::vector<int>> later(threads);
+	// Only the buckets holding vertices exist, so a heavy arc far beyond
+	// the rest costs one more bucket rather than every one up to it
+	std::map<std::uint64_t, std::vector<int>> buckets;
+	buckets[0].push_back(source);
+	std::vector<size_t> settledIn(vertices, 0);
+	size_t pass = 0;
+	std::vector<int> frontier, settled;
+	lower(source, 0);
+	while (!buckets.empty()) {
+		// The vertices still in the lowest bucket, once each
+		std::uint64_t bucket = buckets.begin()->first;
+		ws->begin(vertices);
+		frontier.clear();
+		for (int v : buckets.begin()->second) {
+			if (bucketOf(tentativeOf(v)) == bucket && ws->visit(v)) {
+				frontier.push_back(v);
+			}
+		}
+		buckets.erase(buckets.begin());
+
+		++pass;
+		settled.clear();
+		while (!frontier.empty()) {
+			for (int v : frontier) {
+				if (settledIn[v] != pass) {
+					settledIn[v] = pass;
+					settled.push_back(v);
+				}
+			}
+			ws->begin(vertices);
+			unsigned workers = frontier.size() >= PARALLEL_LEVEL_MIN_WORK / 16 ? threads : 1;
+			parallelFor(frontier.size(), workers, [&](unsigned t, size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					relax(*ws, frontier[i], false, bucket, ws->pieces[t], later[t]);
+				}
+			});
+			frontier.clear();
+			for (unsigned t = 0; t < threads; ++t) {
+				frontier.insert(frontier.end(), ws->pieces[t].begin(), ws->pieces[t].end());
+				ws->pieces[t].clear();
+			}
+		}
+
+		// Heavy arcs lead to a later bucket, unless the bucket numbers run
+		// out or the distances outgrow a double's precision; then the same
+		// bucket comes round again
+		unsigned workers = settled.size() >= PARALLEL_LEVEL_MIN_WORK / 16 ? threads : 1;
+		parallelFor(settled.size(), workers, [&](unsigned t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				relax(*ws, settled[i], true, std::numeric_limits<std::uint64_t>::max(), ws->pieces[t], later[t]);
+			}
+		});
+		for (unsigned t = 0; t < threads; ++t) {
+			for (int v : later[t]) {
+				buckets[bucketOf(tentativeOf(v))].push_back(v);
+			}
+			later[t].clear();
+		}
+	}
+	if (negative.load()) {
+		std::cerr << "Negative edge weight.\n";
+		return false;
+	}
+
+	parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+		for (size_t v = begin; v < end; ++v) {
+			distance[v] = tentativeOf(v);
+		}
+	});
+	// Every vertex in reach has a parent whose distance plus the arc's
+	// weight is exactly its own; claiming each vertex once keeps the
+	// predecessors a tree even across arcs of weight zero
+	ws->begin(vertices);
+	std::vector<int> &level = ws->queue;
+	level.push_back(source);
+	ws->visit(source);
+	while (!level.empty()) {
+		size_t arcs = frontierArcs(level, graph.out);
+		ws->next.clear();
+		parallelLevel(*ws, level.size(), arcs >= PARALLEL_LEVEL_MIN_WORK ? threads : 1, ws->next,
+				[&](std::vector<int> &piece, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				int node = level[i];
+				for (size_t a = graph.out.offset[node]; a < graph.out.offset[node + 1]; ++a) {
+					int next = graph.out.target[a];
+					if (distance[node] + graph.out.weight[a] == distance[next] && ws->claim(next)) {
+						predecessor[next] = node;
+						piece.push_back(next);
+					}
+				}
+			}
+			return size_t(0);
+		});
+		level.swap(ws->next);
+	}
+	return true;
+}
+
+// A delta for delta-stepping from a sample of the weights: the weight that
+// leaves about DELTA_LIGHT_ARCS arcs out of a vertex light. Fewer light
+// arcs mean more buckets to pass through; more mean vertices relaxed again
+// and again within a bucket.
+double Graph::tuneDelta() const {
+	size_t arcs = csr.out.offset[csr.vertices];
+	if (arcs == 0) {
+		return 1;
+	}
+	size_t samples = std::min(arcs, DELTA_SAMPLES);
+	std::vector<double> weights(samples);
+	for (size_t i = 0; i < samples; ++i) {
+		weights[i] = std::max(0.0, csr.out.weight[arcs / samples * i]);
+	}
+	double degree = double(arcs) / std::max<size_t>(csr.vertices - 1, 1);
+	double light = std::min(1.0, DELTA_LIGHT_ARCS / degree);
+	size_t rank = std::min(samples - 1, size_t(light * (samples - 1)));
+	std::nth_element(weights.begin(), weights.begin() + rank, weights.end());
+	double delta = weights[rank];
+	if (delta <= 0) {
+		delta = *std::max_element(weights.begin(), weights.end());
+	}
+	return delta > 0 ? delta : 1;
+}
+
+// Shortest path - A* with the ALT lower bounds (none without landmarks).
+// A vertex whose cost falls is queued again, so a bound a rounding error
+// away from consistent cannot cost the right answer. The labels live in the
+// workspace, valid only for vertices marked this search, so a query touches
+// only the vertices it reaches.
+bool Graph::shortestPath(int source, int target, double &distance, std::vector<int> &path) {
+	const CSR &graph = frozen();
+	const size_t vertices = graph.vertices;
+	const double infinity = std::numeric_limits<double>::infinity();
+	distance = infinity;
+	path.clear();
+	if (source < 1 || (size_t)source >= vertices || target < 1 || (size_t)target >= vertices) {
+		return true;
+	}
+	if (!hierarchy.rank.empty()) {
+		return hierarchyPath(source, target, distance, path);
+	}
+
+	size_t count = landmarks.size();
+	std::vector<double> targetFrom(count), targetTo(count);
+	for (size_t i = 0; i < count; ++i) {
+		targetFrom[i] = landmarkFrom[target * count + i];
+		targetTo[i] = (directed ? landmarkTo : landmarkFrom)[target * count + i];
+	}
+
+	WorkspaceLease ws(*this);
+	ws->begin(vertices);
+	if (ws->cost.size() < vertices) {
+		ws->cost.resize(vertices);
+		ws->bound.resize(vertices);
+		ws->parent.resize(vertices);
+	}
+	typedef std::pair<double, int> Entry;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+	ws->visit(source);
+	ws->cost[source] = 0;
+	ws->bound[source] = landmarkBound(source, targetFrom.data(), targetTo.data());
+	ws->parent[source] = -1;
+	if (ws->bound[source] < infinity) {
+		open.push(Entry(ws->bound[source], source));
+	}
+	while (!open.empty()) {
+		Entry top = open.top();
+		open.pop();
+		int node = top.second;
+		if (top.first > ws->cost[node] + ws->bound[node]) {
+			continue;
+		}
+		if (node == target) {
+			distance = ws->cost[node];
+			for (int v = target; v >= 0; v = ws->parent[v]) {
+				path.push_back(v);
+			}
+			std::reverse(path.begin(), path.end());
 			break;
 		}
+		for (size_t a = graph.out.offset[node]; a < graph.out.offset[node + 1]; ++a) {
+			double weight = graph.out.weight[a];
+			if (weight < 0) {
+				std::cerr << "Negative edge weight.\n";
+				return false;
+			}
+			int next = graph.out.target[a];
+			double cost = ws->cost[node] + weight;
+			if (ws->visit(next)) {
+				ws->bound[next] = landmarkBound(next, targetFrom.data(), targetTo.data());
+			} else if (cost >= ws->cost[next]) {
+				continue;
+			}
+			ws->cost[next] = cost;
+			ws->parent[next] = node;
+			if (ws->bound[next] < infinity) {
+				open.push(Entry(cost + ws->bound[next], next));
+			}
+		}
+	}
+	return true;
+}
+
+// The best lower bound on the distance from v to the target the triangle
+// inequality gives through any landmark L: d(v, t) >= d(L, t) - d(L, v) and
+// d(v, t) >= d(v, L) - d(t, L). Infinity when v cannot reach the target,
+// because L reaches v but not the target, or the target reaches L but v
+// does not.
+double Graph::landmarkBound(int v, const double *targetFrom, const double *targetTo) const {
+	const double infinity = std::numeric_limits<double>::infinity();
+	size_t count = landmarks.size();
+	const double *from = landmarkFrom.data() + v * count;
+	const double *to = (directed ? landmarkTo.data() : landmarkFrom.data()) + v * count;
+	double bound = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (targetFrom[i] < infinity) {
+			if (from[i] < infinity) {
+				bound = std::max(bound, targetFrom[i] - from[i]);
+			}
+		} else if (from[i] < infinity) {
+			return infinity;
+		}
+		if (to[i] < infinity) {
+			if (targetTo[i] < infinity) {
+				bound = std::max(bound, to[i] - targetTo[i]);
+			}
+		} else if (targetTo[i] < infinity) {
+			return infinity;
+		}
 	}
-	return retval;
+	return bound;
 }
 
-// Performs the DFT to check if the graph is a tree
-void Graph::treeHelper(int node, std::vector<int> &vlist) {
-	Edge *edgePtr = edgeList[node];
-	// mark node as visited
-	if (vlist[node] >= 1) {
-		vlist[node] = 2;
+// Landmarks chosen farthest first: the first is the node farthest from node
+// 1, and each next one the node farthest from every landmark so far (a node
+// none of them reach counting as farthest of all). Nodes without edges are
+// never chosen, as no query passes through them.
+bool Graph::buildLandmarks(unsigned count) {
+	const CSR &graph = frozen();
+	const size_t vertices = graph.vertices;
+	const double infinity = std::numeric_limits<double>::infinity();
+	dropLandmarks();
+	if (vertices < 2) {
+		return true;
 	}
-	else {
-		vlist[node] = 1;
+	count = std::min<size_t>(count, vertices - 1);
+
+	std::vector<double> from, to;
+	std::vector<int> predecessor;
+	if (!dijkstra(graph.out, 1, from, predecessor, -1)) {
+		return false;
+	}
+	int landmark = 1;
+	for (size_t v = 1; v < vertices; ++v) {
+		if (from[v] < infinity && from[v] > from[landmark]) {
+			landmark = v;
+		}
 	}
 
-	// while there are still connected nodes
-	while (edgePtr != nullptr) {
-		// if this is the left vertex
-		if (edgePtr->vertex[LEFT] == node) {
-			// if the right vertex has not been visited
-			if (!vlist[edgePtr->vertex[RIGHT]]) {
-				treeHelper(edgePtr->vertex[RIGHT], vlist);
-			}
-			else {
-				// increment pointer
-				edgePtr = edgePtr->link[LEFT];
-			}
+	std::vector<double> nearest(vertices, infinity);
+	std::vector<double> fromAll(vertices * count), toAll(directed ? vertices * count : 0);
+	for (unsigned i = 0; i < count; ++i) {
+		if (!dijkstra(graph.out, landmark, from, predecessor, -1)
+				|| (directed && !dijkstra(graph.in, landmark, to, predecessor, -1))) {
+			dropLandmarks();
+			return false;
 		}
-		// if vertex[LEFT] has not been visited
-		else if (!vlist[edgePtr->vertex[LEFT]]) {
-			treeHelper(edgePtr->vertex[LEFT], vlist);	
+		for (size_t v = 1; v < vertices; ++v) {
+			fromAll[v * count + i] = from[v];
+			if (directed) {
+				toAll[v * count + i] = to[v];
+			}
+			nearest[v] = std::min(nearest[v], from[v]);
 		}
-		else {
-			// increment pointer
-			edgePtr = edgePtr->link[RIGHT];
+		landmarks.push_back(landmark);
+
+		landmark = 0;
+		for (size_t v = 1; v < vertices; ++v) {
+			bool connected = graph.out.offset[v] < graph.out.offset[v + 1] || graph.in.offset[v] < graph.in.offset[v + 1];
+			if (connected && (landmark == 0 || nearest[v] > nearest[landmark])) {
+				landmark = v;
+			}
 		}
+		landmark = std::max(landmark, 1);
 	}
-	return;
+	landmarkFrom.swap(fromAll);
+	landmarkTo.swap(toAll);
+	return true;
 }
 
-// Depth First Traverse - proceed from source
-void Graph::DFT(int source, std::string file) {
+void Graph::dropLandmarks() {
+	landmarks.clear();
+	landmarkFrom.clear();
+	landmarkTo.clear();
+}
 
-	// keeps track of which nodes have been visited
-	std::vector<int> visited = std::vector<int>(edgeList.size(), 0);
-	// keeps track of the order in which the nodes are visited
-	std::queue<int> order;
-	if(!directed) {
-		DFUndirected(source, visited, order);			
-	} else {
-		DFDirected(source, visited, order);
+// Write the landmarks to a binary file
+bool Graph::writeLandmarks(std::string file) {
+	const CSR &graph = frozen();
+	std::FILE *output = std::fopen(file.c_str(), "wb");
+	if (!output) {
+		std::cerr << "Invalid file output.\n";
+		return false;
 	}
-	// print results to file
-	std::ofstream outfile(file, std::ofstream::out);
-	if (outfile.is_open()) {
-		while (!order.empty()) {
-			outfile << order.front() << "\n";
-			order.pop();
-		}
-		outfile.close();
-	} else {
+
+	LandmarkHeader header = LandmarkHeader();
+	std::memcpy(header.magic, LANDMARK_MAGIC, sizeof(header.magic));
+	header.version = LANDMARK_VERSION;
+	header.byteOrder = SNAPSHOT_BYTE_ORDER;
+	header.directed = directed;
+	header.count = landmarks.size();
+	header.vertices = graph.vertices;
+	header.edges = graph.edges;
+	bool ok = writeArray(output, &header, 1)
+		&& writeArray(output, landmarkFrom.data(), landmarkFrom.size())
+		&& writeArray(output, landmarkTo.data(), landmarkTo.size())
+		&& writeArray(output, landmarks.data(), landmarks.size());
+	ok = std::fclose(output) == 0 && ok;
+	if (!ok) {
+		std::cerr << "Invalid file output.\n";
+	}
+	return ok;
+}
+
+// Read landmarks, which must have been written for a graph of this shape
+bool Graph::readLandmarks(std::string file) {
+	const CSR &graph = frozen();
+	std::FILE *input = std::fopen(file.c_str(), "rb");
+	if (!input) {
 		std::cerr << "Could not open input file.\n";
+		return false;
 	}
+
+	dropLandmarks();
+	LandmarkHeader header;
+	bool ok = readArray(input, &header, 1)
+		&& std::memcmp(header.magic, LANDMARK_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == LANDMARK_VERSION
+		&& header.byteOrder == SNAPSHOT_BYTE_ORDER
+		&& header.directed == directed
+		&& header.vertices == graph.vertices
+		&& header.edges == graph.edges
+		&& header.count < graph.vertices;
+	// The file must hold exactly what the header promises before anything
+	// is allocated for it; count is below vertices, so this cannot overflow
+	struct stat info;
+	ok = ok && fstat(fileno(input), &info) == 0
+		&& static_cast<size_t>(info.st_size) == sizeof(header)
+			+ (directed ? 2 : 1) * header.vertices * header.count * sizeof(double)
+			+ header.count * sizeof(int);
+	if (ok) {
+		size_t values = header.vertices * header.count;
+		landmarkFrom.resize(values);
+		landmarkTo.resize(directed ? values : 0);
+		landmarks.resize(header.count);
+		ok = readArray(input, landmarkFrom.data(), landmarkFrom.size())
+			&& readArray(input, landmarkTo.data(), landmarkTo.size())
+			&& readArray(input, landmarks.data(), landmarks.size())
+			&& std::fgetc(input) == EOF;
+	}
+	std::fclose(input);
+	if (!ok) {
+		dropLandmarks();
+		std::cerr << "Invalid landmark file.\n";
+	}
+	return ok;
 }
 
-// Performs the DFT for an undirected graph
-void Graph::DFUndirected(int node, std::vector<int> &vlist, std::queue<int>& olist) {
+// Contraction hierarchy, contracting the vertex of least edge difference
+// (plus the neighbors it has lost, to spread contraction over the graph)
+// next. A vertex's priority is refreshed when it comes off the queue, and
+// it goes back in if it is no longer the least.
+bool Graph::buildHierarchy() {
+	const CSR &graph = frozen();
+	const size_t vertices = graph.vertices;
+	hierarchy = Hierarchy();
+	Contraction contraction(vertices);
+	for (size_t v = 1; v < vertices; ++v) {
+		for (size_t a = graph.out.offset[v]; a < graph.out.offset[v + 1]; ++a) {
+			if (graph.out.weight[a] < 0) {
+				std::cerr << "Negative edge weight.\n";
+				return false;
+			}
+			contraction.addArc(v, graph.out.target[a], graph.out.weight[a], -1);
+		}
+	}
 
-	Edge *edgePtr = edgeList[node];
-	vlist[node] = 1;
+	typedef std::pair<int, int> Entry;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> order;
+	std::vector<int> priority(vertices, 0), lost(vertices, 0);
+	for (size_t v = 1; v < vertices; ++v) {
+		priority[v] = contraction.priority(v);
+		order.push(Entry(priority[v], v));
+	}
+	std::vector<int> rank(vertices, 0);
+	int contracted = 0;
+	while (!order.empty()) {
+		Entry top = order.top();
+		order.pop();
+		int v = top.second;
+		if (rank[v] != 0 || top.first != priority[v]) {
+			continue;
+		}
+		priority[v] = contraction.priority(v) + lost[v];
+		if (!order.empty() && priority[v] > order.top().first) {
+			order.push(Entry(priority[v], v));
+			continue;
+		}
 
-	while (edgePtr != nullptr) {
-		if (!vlist[edgePtr->vertex[RIGHT]]) {
-			DFUndirected(edgePtr->vertex[RIGHT], vlist, olist);
-		} else if (!vlist[edgePtr->vertex[LEFT]]) {
-			DFUndirected(edgePtr->vertex[LEFT], vlist, olist);
+		contraction.contract(v);
+		rank[v] = ++contracted;
+		std::vector<int> neighbors;
+		for (const Contraction::Arc &arc : contraction.out[v]) {
+			neighbors.push_back(arc.vertex);
+		}
+		for (const Contraction::Arc &arc : contraction.in[v]) {
+			neighbors.push_back(arc.vertex);
+		}
+		std::sort(neighbors.begin(), neighbors.end());
+		neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+		for (int n : neighbors) {
+			++lost[n];
 		}
-		edgePtr = edgePtr->vertex[LEFT] == node ? edgePtr->link[LEFT] : edgePtr->link[RIGHT];
 	}
 
-	olist.push(node);
+	auto flatten = [&](std::vector<std::vector<Contraction::Arc>> &lists, AdjacencyStorage &adj, std::vector<int> &middle) {
+		adj.offset.assign(vertices + 1, 0);
+		for (size_t v = 1; v < vertices; ++v) {
+			std::vector<Contraction::Arc> &arcs = lists[v];
+			std::sort(arcs.begin(), arcs.end(), [](const Contraction::Arc &a, const Contraction::Arc &b) {
+				return a.vertex < b.vertex;
+			});
+			for (const Contraction::Arc &arc : arcs) {
+				adj.target.push_back(arc.vertex);
+				adj.weight.push_back(arc.weight);
+				middle.push_back(arc.middle);
+			}
+			adj.offset[v + 1] = adj.target.size();
+		}
+		adj.offset[0] = adj.offset[1] = 0;
+	};
+	flatten(contraction.out, hierarchy.up, hierarchy.upMiddle);
+	flatten(contraction.in, hierarchy.down, hierarchy.downMiddle);
+	hierarchy.rank.swap(rank);
+	return true;
 }
 
-// Performs the DFT for a directed graph
-void Graph::DFDirected(int node, std::vector<int> &vlist, std::queue<int>& olist) {
+// Search up the hierarchy from the source along up arcs and from the target
+// along down arcs, each side stopping once it cannot improve on the best
+// meeting so far. The path is then unpacked, shortcut by shortcut.
+// Forward, a node's down arcs lead in from higher nodes, and backward its up
+// arcs lead out to them, so each side checks the other's arcs to stall.
+bool Graph::hierarchyPath(int source, int target, double &distance, std::vector<int> &path) {
+	const size_t vertices = hierarchy.rank.size();
+	const double infinity = std::numeric_limits<double>::infinity();
+	typedef std::pair<double, int> Entry;
+	WorkspaceLease forward(*this), backward(*this);
+	Workspace *side[2] = {&*forward, &*backward};
+	const AdjacencyStorage *arcs[2] = {&hierarchy.up, &hierarchy.down};
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open[2];
+	int ends[2] = {source, target};
+	for (int s = 0; s < 2; ++s) {
+		Workspace &ws = *side[s];
+		ws.begin(vertices);
+		if (ws.cost.size() < vertices) {
+			ws.cost.resize(vertices);
+			ws.bound.resize(vertices);
+			ws.parent.resize(vertices);
+		}
+		ws.visit(ends[s]);
+		ws.cost[ends[s]] = 0;
+		ws.parent[ends[s]] = -1;
+		open[s].push(Entry(0, ends[s]));
+	}
 
-	Edge *edgePtr = edgeList[node];
-	vlist[node] = 1;
+	double best = infinity;
+	int meet = -1;
+	while (true) {
+		bool live[2];
+		for (int s = 0; s < 2; ++s) {
+			live[s] = !open[s].empty() && open[s].top().first < best;
+		}
+		if (!live[0] && !live[1]) {
+			break;
+		}
+		int s = !live[0] || (live[1] && open[1].top().first < open[0].top().first);
+		Workspace &ws = *side[s];
+		Workspace &other = *side[1 - s];
+		Entry top = open[s].top();
+		open[s].pop();
+		int node = top.second;
+		if (top.first > ws.cost[node]) {
+			continue;
+		}
+		if (other.visited(node) && top.first + other.cost[node] < best) {
+			best = top.first + other.cost[node];
+			meet = node;
+		}
+		// Stall on demand: a node this side reaches more cheaply from
+		// above is not on any shortest path the search needs
+		const AdjacencyStorage &against = *arcs[1 - s];
+		bool stalled = false;
+		for (size_t a = against.offset[node]; a < against.offset[node + 1] && !stalled; ++a) {
+			int above = against.target[a];
+			stalled = ws.visited(above) && ws.cost[above] + against.weight[a] < top.first;
+		}
+		if (stalled) {
+			continue;
+		}
+		const AdjacencyStorage &adj = *arcs[s];
+		for (size_t a = adj.offset[node]; a < adj.offset[node + 1]; ++a) {
+			int next = adj.target[a];
+			double cost = top.first + adj.weight[a];
+			if (!ws.visit(next) && cost >= ws.cost[next]) {
+				continue;
+			}
+			ws.cost[next] = cost;
+			ws.parent[next] = node;
+			open[s].push(Entry(cost, next));
+		}
+	}
+	if (meet < 0) {
+		return true;
+	}
 
-	while(edgePtr != nullptr) {
-		if (edgePtr->direction == 1 && !vlist[edgePtr->vertex[RIGHT]]) {
-			DFDirected(edgePtr->vertex[RIGHT], vlist, olist);
-		} else if (edgePtr->direction == 2 && !vlist[edgePtr->vertex[LEFT]]) {
-			DFDirected(edgePtr->vertex[LEFT], vlist, olist);
+	// The hierarchy's path, source to meet to target, then each of its
+	// arcs replaced by the two it bypasses until none is a shortcut
+	std::vector<int> rough;
+	for (int v = meet; v >= 0; v = forward->parent[v]) {
+		rough.push_back(v);
+	}
+	std::reverse(rough.begin(), rough.end());
+	for (int v = backward->parent[meet]; v >= 0; v = backward->parent[v]) {
+		rough.push_back(v);
+	}
+	distance = best;
+	path.push_back(source);
+	std::vector<int> pending;
+	for (size_t i = rough.size() - 1; i > 0; --i) {
+		pending.push_back(rough[i]);
+	}
+	while (!pending.empty()) {
+		int to = pending.back();
+		int middle = hierarchyMiddle(path.back(), to);
+		if (middle < 0) {
+			path.push_back(to);
+			pending.pop_back();
+		} else {
+			pending.push_back(middle);
 		}
-		edgePtr = edgePtr->vertex[LEFT] == node ? edgePtr->link[LEFT] : edgePtr->link[RIGHT];
 	}
+	return true;
+}
 
-	olist.push(node);
+// The vertex the hierarchy's arc from -> to bypasses (-1 for an edge),
+// found among the arcs of its lower end
+int Graph::hierarchyMiddle(int from, int to) const {
+	bool up = hierarchy.rank[from] < hierarchy.rank[to];
+	const AdjacencyStorage &adj = up ? hierarchy.up : hierarchy.down;
+	int lower = up ? from : to;
+	int higher = up ? to : from;
+	const int *begin = adj.target.data() + adj.offset[lower];
+	const int *end = adj.target.data() + adj.offset[lower + 1];
+	const int *arc = std::lower_bound(begin, end, higher);
+	return (up ? hierarchy.upMiddle : hierarchy.downMiddle)[arc - adj.target.data()];
 }
 
-void Graph::BFT(int source, std::string file) {
-	std::queue<int> order;
-	std::vector<bool> visited(edgeList.size(), false);
-	breadthFirstApply(visited, source, [&](int node) {
-		order.push(node);	
+// Write the contraction hierarchy to a binary file
+bool Graph::writeHierarchy(std::string file) {
+	const CSR &graph = frozen();
+	if (hierarchy.rank.empty()) {
+		std::cerr << "No hierarchy to write.\n";
 		return false;
-	}, !directed);
+	}
+	std::FILE *output = std::fopen(file.c_str(), "wb");
+	if (!output) {
+		std::cerr << "Invalid file output.\n";
+		return false;
+	}
 
-	std::ofstream outfile(file);
-	if (outfile) {
-		// std::cout << order.size() << "\n";
-		while (!order.empty()) {
-			int node = order.front();
-			order.pop();
-			outfile << node << "\n";
-		}
+	HierarchyHeader header = HierarchyHeader();
+	std::memcpy(header.magic, HIERARCHY_MAGIC, sizeof(header.magic));
+	header.version = HIERARCHY_VERSION;
+	header.byteOrder = SNAPSHOT_BYTE_ORDER;
+	header.directed = directed;
+	header.vertices = graph.vertices;
+	header.edges = graph.edges;
+	header.upArcs = hierarchy.up.target.size();
+	header.downArcs = hierarchy.down.target.size();
+	bool ok = writeArray(output, &header, 1)
+		&& writeArray(output, hierarchy.up.offset.data(), hierarchy.up.offset.size())
+		&& writeArray(output, hierarchy.down.offset.data(), hierarchy.down.offset.size())
+		&& writeArray(output, hierarchy.up.weight.data(), header.upArcs)
+		&& writeArray(output, hierarchy.down.weight.data(), header.downArcs)
+		&& writeArray(output, hierarchy.rank.data(), hierarchy.rank.size())
+		&& writeArray(output, hierarchy.up.target.data(), header.upArcs)
+		&& writeArray(output, hierarchy.upMiddle.data(), header.upArcs)
+		&& writeArray(output, hierarchy.down.target.data(), header.downArcs)
+		&& writeArray(output, hierarchy.downMiddle.data(), header.downArcs);
+	ok = std::fclose(output) == 0 && ok;
+	if (!ok) {
+		std::cerr << "Invalid file output.\n";
 	}
+	return ok;
 }
-// Breadth First search - proceed from source
-/*void Graph::BFT(int source, std::string file) {
-	// keeps track of which nodes have been visited
-	std::vector<int> visited = std::vector<int>(edgeList.size(), 0);
-	// keeps track of the order in which the nodes are visited
-	std::queue<int> order;
-	if(!directed) {
-		BFUndirected(source, visited, order);			
-	} else {
-		BFDirected(source, visited, order);
+
+// Read a contraction hierarchy written for a graph of this shape
+bool Graph::readHierarchy(std::string file) {
+	const CSR &graph = frozen();
+	std::FILE *input = std::fopen(file.c_str(), "rb");
+	if (!input) {
+		std::cerr << "Could not open input file.\n";
+		return false;
 	}
-	// print results to file
-	std::ofstream outfile(file, std::ofstream::out);
-	if (outfile.is_open()) {
-		while (!order.empty()) {
-			outfile << order.front() << "\n";
-			order.pop();
+
+	hierarchy = Hierarchy();
+	HierarchyHeader header;
+	bool ok = readArray(input, &header, 1)
+		&& std::memcmp(header.magic, HIERARCHY_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == HIERARCHY_VERSION
+		&& header.byteOrder == SNAPSHOT_BYTE_ORDER
+		&& header.directed == directed
+		&& header.vertices == graph.vertices
+		&& header.edges == graph.edges;
+	// Bound the arc counts by the file's length before allocating for them
+	struct stat info;
+	ok = ok && fstat(fileno(input), &info) == 0
+		&& header.upArcs < static_cast<size_t>(info.st_size)
+		&& header.downArcs < static_cast<size_t>(info.st_size);
+	if (ok) {
+		size_t vertices = header.vertices;
+		hierarchy.up.offset.resize(vertices + 1);
+		hierarchy.down.offset.resize(vertices + 1);
+		hierarchy.up.weight.resize(header.upArcs);
+		hierarchy.down.weight.resize(header.downArcs);
+		hierarchy.rank.resize(vertices);
+		hierarchy.up.target.resize(header.upArcs);
+		hierarchy.upMiddle.resize(header.upArcs);
+		hierarchy.down.target.resize(header.downArcs);
+		hierarchy.downMiddle.resize(header.downArcs);
+		ok = readArray(input, hierarchy.up.offset.data(), vertices + 1)
+			&& readArray(input, hierarchy.down.offset.data(), vertices + 1)
+			&& readArray(input, hierarchy.up.weight.data(), header.upArcs)
+			&& readArray(input, hierarchy.down.weight.data(), header.downArcs)
+			&& readArray(input, hierarchy.rank.data(), vertices)
+			&& readArray(input, hierarchy.up.target.data(), header.upArcs)
+			&& readArray(input, hierarchy.upMiddle.data(), header.upArcs)
+			&& readArray(input, hierarchy.down.target.data(), header.downArcs)
+			&& readArray(input, hierarchy.downMiddle.data(), header.downArcs)
+			&& std::fgetc(input) == EOF
+			&& validOffsets(hierarchy.up.offset.data(), vertices, header.upArcs)
+			&& validOffsets(hierarchy.down.offset.data(), vertices, header.downArcs)
+			&& validVertices(hierarchy.up.target.data(), header.upArcs, vertices)
+			&& validVertices(hierarchy.down.target.data(), header.downArcs, vertices);
+	}
+	std::fclose(input);
+
+	// Queries and unpacking follow the arcs without checks: each vertex's
+	// arcs must lead to higher ranked vertices in order of target, and a
+	// shortcut's middle must be a lower ranked vertex with the two arcs the
+	// shortcut stands for. Middles then fall in rank, so unpacking ends.
+	const std::vector<int> &rank = hierarchy.rank;
+	auto hasArc = [&](const AdjacencyStorage &adj, int lower, int higher) {
+		const int *begin = adj.target.data() + adj.offset[lower];
+		const int *end = adj.target.data() + adj.offset[lower + 1];
+		const int *arc = std::lower_bound(begin, end, higher);
+		return arc != end && *arc == higher;
+	};
+	auto validArcs = [&](const AdjacencyStorage &adj, const std::vector<int> &middle, bool up) {
+		for (size_t v = 1; v < rank.size(); ++v) {
+			for (size_t i = adj.offset[v]; i < adj.offset[v + 1]; ++i) {
+				int w = adj.target[i];
+				int m = middle[i];
+				if (rank[w] <= rank[v] || (i > adj.offset[v] && adj.target[i - 1] > w)) {
+					return false;
+				}
+				if (m == -1) {
+					continue;
+				}
+				if (m < 1 || (size_t)m >= rank.size() || rank[m] >= rank[v]
+						|| !hasArc(hierarchy.down, m, up ? v : w) || !hasArc(hierarchy.up, m, up ? w : v)) {
+					return false;
+				}
+			}
 		}
-		outfile.close();
-	} else {
-		std::cerr << "Could not open input file.\n";
+		return true;
+	};
+	ok = ok && hierarchy.up.offset[1] == 0 && hierarchy.down.offset[1] == 0
+		&& validArcs(hierarchy.up, hierarchy.upMiddle, true)
+		&& validArcs(hierarchy.down, hierarchy.downMiddle, false);
+	if (!ok) {
+		hierarchy = Hierarchy();
+		std::cerr << "Invalid hierarchy file.\n";
 	}
+	return ok;
 }
 
-void Graph::BFUndirected(int node, std::vector<int> &vlist, std::queue<int> &olist) {
-	std::queue<int> nodeQueue;
-	nodeQueue.push(node);
-	while (!nodeQueue.empty()) {
-		int node = nodeQueue.front();
-		nodeQueue.pop();
-		if (vlist[node] == 1) {
-			return;
-		}
-		vlist[node] = 1;
+// Pruned landmark labeling (Akiba, Iwata and Yoshida). The breadth first
+// search from each hub labels a vertex with the hub and its depth, unless
+// the labels so far already give a path no longer, in which case the search
+// goes no further that way. On directed graphs the search runs forwards to
+// fill in labels and backwards to fill out labels.
+void Graph::buildHubLabels() {
+	const CSR &graph = frozen();
+	const size_t vertices = graph.vertices;
+	const std::uint32_t unknown = std::numeric_limits<std::uint32_t>::max();
+	dropHubLabels();
+	if (vertices < 2) {
+		return;
+	}
 
-		Edge *edge = edgeList[node];
-		while (edge) {
-			if (edge->vertex[LEFT] == node && !vlist[edge->vertex[RIGHT]]) {
-				nodeQueue.push(edge->vertex[RIGHT]);
-			} else if (edge->vertex[RIGHT] == node && !vlist[edge->vertex[LEFT]]) {
-				nodeQueue.push(edge->vertex[LEFT]);
+	std::vector<int> order(vertices - 1);
+	for (size_t v = 1; v < vertices; ++v) {
+		order[v - 1] = v;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		return degree(a, false) + (directed ? graph.in.offset[a + 1] - graph.in.offset[a] : 0)
+			> degree(b, false) + (directed ? graph.in.offset[b + 1] - graph.in.offset[b] : 0);
+	});
+
+	// Labels are added hub by hub, in rank order, so each stays sorted
+	std::vector<std::vector<HubLabel>> outLabels(vertices), inLabels(directed ? vertices : 0);
+	std::vector<std::vector<HubLabel>> &toLabels = directed ? inLabels : outLabels;
+	// Per-thread hop counts from the hub to each hub in its labels
+	std::vector<std::vector<std::uint32_t>> tables(threads);
+
+	// Search from hub along adj, finding the vertices that the hub's own
+	// labels (from) and theirs (to) do not already connect closely enough
+	auto search = [&](Workspace &ws, std::vector<std::uint32_t> &table, int hub, const Adjacency &adj,
+			const std::vector<std::vector<HubLabel>> &from, const std::vector<std::vector<HubLabel>> &to,
+			std::vector<std::pair<int, std::uint32_t>> &found) {
+		if (table.empty()) {
+			table.assign(vertices, unknown);
+		}
+		for (const HubLabel &label : from[hub]) {
+			table[label.hub] = label.hops;
+		}
+		ws.begin(vertices);
+		std::vector<int> &queue = ws.queue;
+		queue.push_back(hub);
+		ws.visit(hub);
+		size_t head = 0;
+		for (std::uint32_t depth = 0; head < queue.size(); ++depth) {
+			for (size_t levelEnd = queue.size(); head < levelEnd; ++head) {
+				int node = queue[head];
+				bool covered = false;
+				for (const HubLabel &label : to[node]) {
+					if (table[label.hub] != unknown && table[label.hub] + label.hops <= depth) {
+						covered = true;
+						break;
+					}
+				}
+				if (covered) {
+					continue;
+				}
+				found.push_back(std::make_pair(node, depth));
+				for (size_t a = adj.offset[node]; a < adj.offset[node + 1]; ++a) {
+					if (ws.visit(adj.target[a])) {
+						queue.push_back(adj.target[a]);
+					}
+				}
 			}
-
-			edge = edge->vertex[LEFT] == node ? edge->link[LEFT] : edge->link[RIGHT];
 		}
+		for (const HubLabel &label : from[hub]) {
+			table[label.hub] = unknown;
+		}
+	};
 
-		olist.push(node);
+	size_t done = 0;
+	while (done < order.size()) {
+		size_t batch = threads > 1 ? std::max<size_t>(1, std::min(LABEL_BATCH, done / LABEL_BATCH_SHARE)) : 1;
+		batch = std::min(batch, order.size() - done);
+		std::vector<std::vector<std::pair<int, std::uint32_t>>> forward(batch), backward(directed ? batch : 0);
+		parallelFor(batch, threads, [&](unsigned t, size_t begin, size_t end) {
+			WorkspaceLease ws(*this);
+			for (size_t i = begin; i < end; ++i) {
+				int hub = order[done + i];
+				search(*ws, tables[t], hub, graph.out, outLabels, toLabels, forward[i]);
+				if (directed) {
+					search(*ws, tables[t], hub, graph.in, inLabels, outLabels, backward[i]);
+				}
+			}
+		});
+		for (size_t i = 0; i < batch; ++i) {
+			std::uint32_t rank = done + i;
+			for (const std::pair<int, std::uint32_t> &reached : forward[i]) {
+				toLabels[reached.first].push_back(HubLabel{rank, reached.second});
+			}
+			if (directed) {
+				for (const std::pair<int, std::uint32_t> &reached : backward[i]) {
+					outLabels[reached.first].push_back(HubLabel{rank, reached.second});
+				}
+			}
+		}
+		done += batch;
 	}
-}*/
 
-/*void Graph::BFDirected(int node, std::vector<int> &vlist, std::queue<int> &olist) {
-	std::queue<int> nodeQueue;
-	nodeQueue.push(node);
-	while (!nodeQueue.empty()) {
-		int node = nodeQueue.front();
-		nodeQueue.pop();
-		if (vlist[node] == 1) {
-			return;
+	auto flatten = [&](std::vector<std::vector<HubLabel>> &labels, LabelStorage &runs) {
+		runs.offset.assign(vertices + 1, 0);
+		for (size_t v = 0; v < vertices; ++v) {
+			runs.offset[v + 1] = runs.offset[v] + labels[v].size();
 		}
-		vlist[node] = 1;
-
-		Edge *edge = edgeList[node];
-		while (edge) {
-			if (edge->vertex[LEFT] == node && !vlist[edge->vertex[RIGHT]] && edge->direction == 1) {
-				nodeQueue.push(edge->vertex[RIGHT]);
-			} else if (edge->vertex[RIGHT] == node && !vlist[edge->vertex[LEFT]] && edge->direction == 2) {
-				nodeQueue.push(edge->vertex[LEFT]);
+		runs.label.resize(runs.offset[vertices]);
+		parallelFor(vertices, threads, [&](unsigned, size_t begin, size_t end) {
+			for (size_t v = begin; v < end; ++v) {
+				std::copy(labels[v].begin(), labels[v].end(), runs.label.begin() + runs.offset[v]);
+				std::vector<HubLabel>().swap(labels[v]);
 			}
+		});
+	};
+	flatten(outLabels, hubOut);
+	hubLabels.vertices = vertices;
+	hubLabels.out.offset = hubOut.offset.data();
+	hubLabels.out.label = hubOut.label.data();
+	if (directed) {
+		flatten(inLabels, hubIn);
+		hubLabels.in.offset = hubIn.offset.data();
+		hubLabels.in.label = hubIn.label.data();
+	} else {
+		hubLabels.in = hubLabels.out;
+	}
+}
 
-			edge = edge->vertex[LEFT] == node ? edge->link[LEFT] : edge->link[RIGHT];
+// Closeness from the labels: the fewest hops through any hub both share
+int Graph::labelDistance(int v1, int v2) const {
+	const HubLabel *out = hubLabels.out.label + hubLabels.out.offset[v1];
+	const HubLabel *outEnd = hubLabels.out.label + hubLabels.out.offset[v1 + 1];
+	const HubLabel *in = hubLabels.in.label + hubLabels.in.offset[v2];
+	const HubLabel *inEnd = hubLabels.in.label + hubLabels.in.offset[v2 + 1];
+	std::uint32_t best = std::numeric_limits<std::uint32_t>::max();
+	while (out != outEnd && in != inEnd) {
+		if (out->hub < in->hub) {
+			++out;
+		} else if (in->hub < out->hub) {
+			++in;
+		} else {
+			best = std::min(best, out->hops + in->hops);
+			++out;
+			++in;
 		}
-
-		olist.push(node);
 	}
-}*/
+	return best == std::numeric_limits<std::uint32_t>::max() ? -1 : int(best);
+}
 
-	
-// Closeness - determine minimum number of edges to get
-// from one node to the other
-int Graph::closeness(int v1, int v2) {
-	if(v1 == v2){
-		return 0;
+void Graph::dropHubLabels() {
+	hubLabels = HubLabels();
+	hubOut = LabelStorage();
+	hubIn = LabelStorage();
+	if (labelMapping) {
+		munmap(labelMapping, labelMappingLength);
+		labelMapping = nullptr;
+		labelMappingLength = 0;
 	}
-	std::vector<int> distance = std::vector<int>(edgeList.size(), 0xFF);
-	std::set<int> unvisited;
-	for(uint i = 0; i < edgeList.size(); i++){
-		unvisited.insert(i);
+}
+
+// Write the hub labels to a binary file
+bool Graph::writeHubLabels(std::string file) {
+	const CSR &graph = frozen();
+	if (!hubLabels.vertices) {
+		std::cerr << "No hub labels to write.\n";
+		return false;
 	}
-	bool finished = false;
-	int retval = -1;
-	distance[v1] = 0;
-	int node = v1;
-	//while all nodes have not been visited
-	while(!finished){
-		if(!directed){
-			undirectedClose(node, distance, unvisited);
-		}	
-		else{
-			directedClose(node, distance, unvisited);
-		}
-		//mark current node as visited
-		unvisited.erase(node);
-		finished = true;
-		//find the next unvisited node with the smallest distance
-		for(auto i = unvisited.begin(); i != unvisited.end(); i++){
-			if(finished){
-				node = *i;
-				finished = false;
-			}
-			else if(distance[*i] < distance[node]){
-				node = *i;
-			}
-		}
-		//if we have visited all nodes
-		if(finished){
-			retval = distance[v2];
-			if(retval == 0xFF){
-				retval = -1;
-			}
-		}
+	std::FILE *output = std::fopen(file.c_str(), "wb");
+	if (!output) {
+		std::cerr << "Invalid file output.\n";
+		return false;
 	}
-	return retval;
-}
 
-//finds distances of adjacent nodes in an undirected graph
-void Graph::undirectedClose(int v1, std::vector<int> &distance, std::set<int> unvisited){
-	Edge *edgePtr = edgeList[v1];
-	//for all edges
-	while(edgePtr != nullptr){
-		//find which node it is pointing to
-		int next = (edgePtr->vertex[LEFT] == v1 ? edgePtr->vertex[RIGHT] : edgePtr->vertex[LEFT]);	
-		//relative distance = distance of v1 + 1, if smaller than current value
-		if(unvisited.count(next)){
-			distance[next] = std::min((distance[v1] + 1), distance[next]);
-		}
-		//iterate edge pointer
-		edgePtr = (edgePtr->vertex[LEFT] == v1 ? edgePtr->link[LEFT] : edgePtr->link[RIGHT]);
+	HubLabelHeader header = HubLabelHeader();
+	std::memcpy(header.magic, HUB_LABEL_MAGIC, sizeof(header.magic));
+	header.version = HUB_LABEL_VERSION;
+	header.byteOrder = SNAPSHOT_BYTE_ORDER;
+	header.directed = directed;
+	header.vertices = graph.vertices;
+	header.edges = graph.edges;
+	header.outLabels = hubLabels.out.offset[graph.vertices];
+	header.inLabels = directed ? hubLabels.in.offset[graph.vertices] : 0;
+	bool ok = writeArray(output, &header, 1)
+		&& writeArray(output, hubLabels.out.offset, graph.vertices + 1)
+		&& (!directed || writeArray(output, hubLabels.in.offset, graph.vertices + 1))
+		&& writeArray(output, hubLabels.out.label, header.outLabels)
+		&& writeArray(output, hubLabels.in.label, header.inLabels);
+	ok = std::fclose(output) == 0 && ok;
+	if (!ok) {
+		std::cerr << "Invalid file output.\n";
 	}
+	return ok;
 }
 
+// Map hub labels written for a graph of this shape
+bool Graph::mapHubLabels(std::string file) {
+	static_assert(sizeof(size_t) == sizeof(std::uint64_t) && sizeof(HubLabel) == 2 * sizeof(std::uint32_t),
+			"Hub label files store 64-bit offsets and 32-bit hubs and hops");
+	const CSR &graph = frozen();
 
-//finds distances of adjacent nodes in an undirected graph
-void Graph::directedClose(int v1, std::vector<int> &distance, std::set<int> unvisited){
-	Edge *edgePtr = edgeList[v1];
-	//for all edges
-	while(edgePtr != nullptr){
-	if((edgePtr->vertex[LEFT] == v1 && edgePtr->direction == LEFT) || (edgePtr->vertex[RIGHT] == v1 && edgePtr->direction == RIGHT)){			
-			//find which node it is pointing to
-			int next = (edgePtr->vertex[LEFT] == v1 ? edgePtr->vertex[RIGHT] : edgePtr->vertex[LEFT]);	
-			//relative distance = distance of v1 + 1, if smaller than current value
-			if(unvisited.count(next)){
-				distance[next] = std::min((distance[v1] + 1), distance[next]);
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "Could not open input file.\n";
+		return false;
+	}
+	struct stat info;
+	void *base = MAP_FAILED;
+	size_t length = 0;
+	if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(HubLabelHeader)) {
+		length = info.st_size;
+		base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (base == MAP_FAILED) {
+		std::cerr << "Invalid hub label file.\n";
+		return false;
+	}
+
+	const char *bytes = static_cast<const char *>(base);
+	HubLabelHeader header;
+	std::memcpy(&header, bytes, sizeof(header));
+	// The counts are checked against the file's length before the sizes are
+	// worked out, so they cannot overflow
+	bool valid = std::memcmp(header.magic, HUB_LABEL_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == HUB_LABEL_VERSION
+		&& header.byteOrder == SNAPSHOT_BYTE_ORDER
+		&& header.directed == directed
+		&& header.vertices == graph.vertices
+		&& header.edges == graph.edges
+		&& header.outLabels < length && header.inLabels < length
+		&& (directed || header.inLabels == 0);
+	size_t offsets = header.vertices + 1;
+	size_t expected = sizeof(header)
+		+ (directed ? 2 : 1) * offsets * sizeof(size_t)
+		+ (header.outLabels + header.inLabels) * sizeof(HubLabel);
+	HubLabels mapped = HubLabels();
+	if (valid && expected == length) {
+		size_t cursor = sizeof(header);
+		mapped.vertices = header.vertices;
+		mapped.out.offset = takeArray<size_t>(bytes, cursor, offsets);
+		mapped.in.offset = directed ? takeArray<size_t>(bytes, cursor, offsets) : mapped.out.offset;
+		mapped.out.label = takeArray<HubLabel>(bytes, cursor, header.outLabels);
+		mapped.in.label = directed ? takeArray<HubLabel>(bytes, cursor, header.inLabels) : mapped.out.label;
+	}
+	// labelDistance merges runs without bounds checks, so each run must lie
+	// inside its array and hold real hubs in rising order, with hop counts
+	// no path could exceed
+	auto validRuns = [&](const LabelRuns &runs, size_t count) {
+		if (!validOffsets(runs.offset, header.vertices, count)) {
+			return false;
+		}
+		for (size_t v = 0; v < header.vertices; ++v) {
+			for (size_t i = runs.offset[v]; i < runs.offset[v + 1]; ++i) {
+				if (runs.label[i].hub >= header.vertices - 1 || runs.label[i].hops >= header.vertices
+						|| (i > runs.offset[v] && runs.label[i - 1].hub >= runs.label[i].hub)) {
+					return false;
+				}
 			}
 		}
-		//iterate edge pointer
-		edgePtr = (edgePtr->vertex[LEFT] == v1 ? edgePtr->link[LEFT] : edgePtr->link[RIGHT]);
+		return true;
+	};
+	valid = valid && expected == length
+		&& validRuns(mapped.out, header.outLabels)
+		&& (!directed || validRuns(mapped.in, header.inLabels));
+	if (!valid) {
+		munmap(base, length);
+		std::cerr << "Invalid hub label file.\n";
+		return false;
 	}
+
+	dropHubLabels();
+	labelMapping = base;
+	labelMappingLength = length;
+	hubLabels = mapped;
+	return true;
 }
 
 // Partition - determine if you can partition the graph
 bool Graph::partitionable() {
-	std::vector<int> group(edgeList.size(), 0);
-	std::vector<bool> visited(edgeList.size(), 0);
+	const CSR &graph = frozen();
+	if (graph.vertices < 2) {
+		return true;
+	}
 
-	int currentGroup = 1;
+	// Every edge of a breadth first search joins two nodes at most one
+	// level apart, so splitting the levels into odd and even depths fails
+	// exactly when an edge joins two nodes of the same level. Each level is
+	// flagged in the frontier bitmap and its edges checked against it.
+	WorkspaceLease ws(*this);
+	ws->begin(graph.vertices);
+	size_t unexploredArcs = arcCount(true);
 	bool partitionable = true;
-	breadthFirstApply(visited, 1, [&](int node) {
-		if (group[node] == 0) {
-			group[node] = currentGroup;
-		}
-
-		currentGroup = group[node] == 1 ? 2 : 1;
-		Edge *e = edgeList[node];
-		while (e) {
-			int child = e->vertex[LEFT] == node ? e->vertex[RIGHT] : e->vertex[LEFT];
-			if (group[child] == 0) {
-				group[child] = currentGroup;
-			} else if (group[child] != currentGroup) {
-				partitionable = false;
-				return true;
+	levelSearch(*ws, 1, true, unexploredArcs, [&](const std::vector<int> &level, int) {
+		for (int node : level) {
+			ws->setFrontier(node, true);
+		}
+		size_t arcs = frontierArcs(level, graph.out) + (directed ? frontierArcs(level, graph.in) : 0);
+		std::atomic<bool> conflict(false);
+		parallelFor(level.size(), arcs >= PARALLEL_LEVEL_MIN_WORK ? threads : 1, [&](unsigned, size_t begin, size_t end) {
+			for (size_t i = begin; i < end && !conflict.load(std::memory_order_relaxed); ++i) {
+				forEachNeighbor(level[i], true, [&](int child) {
+					if (ws->inFrontier(child)) {
+						conflict.store(true, std::memory_order_relaxed);
+					}
+				});
 			}
-
-			e = e->vertex[LEFT] == node ? e->link[LEFT] : e->link[RIGHT];
+		});
+		for (int node : level) {
+			ws->setFrontier(node, false);
 		}
-
-		return false;
-	}, true);
+		partitionable = !conflict;
+		return conflict.load();
+	});
 
 	return partitionable;
 }
 
-
-void Graph::breadthFirstApply(std::vector<bool> &visited, int source, const std::function<bool(int)> &lambda, bool ignoreDirections) {
-	std::queue<int> vertices;
-	vertices.push(source);
-	while (!vertices.empty()) {
-		int node = vertices.front();
-//		std::cout << node << "\n";
-		vertices.pop();
-
-		if (visited[node]) {
-			break;
-		}
-
-		visited[node] = true;
-		if (lambda(node)) {
-			break;
-		}
-
-		Edge *e = edgeList[node];
-		while (e) {
-			if (e->vertex[LEFT] && !visited[e->vertex[RIGHT]]
-				&& (ignoreDirections || (directed && e->direction == LEFT))) {
-				vertices.push(e->vertex[RIGHT]);
-			} else if (e->vertex[RIGHT] && !visited[e->vertex[LEFT]]
-				&& (ignoreDirections || (directed && e->direction == RIGHT))) {
-				vertices.push(e->vertex[LEFT]);
-			}
-
-			e = e->vertex[LEFT] == node ? e->link[LEFT] : e->link[RIGHT];
-		}
-	}
-}
-		
 // * MST - print the minimum spanning tree of the graph
 // to a file with the passed name
 // Kruskal's - minimum spanning forrest 
 
 // There is a lot of stuff here. It works, and that's what matters.
-bool Graph::MST(std::string file) {
-	std::vector<bool> included(edgeList.size(), 0);
-
+bool Graph::MST(std::string file, MSTMethod method) {
 	std::ofstream outfile(file);
 	if (!outfile) {
 		return false;
@@ -662,117 +3841,180 @@ bool Graph::MST(std::string file) {
 		return true;
 	}
 
-	// Declare a comparator for use in sortingv1 the edges by minimum weight.
-	auto edgeComparator = [](const Edge *e1, const Edge *e2) {
-		return (e1->direction == RIGHT ? e1->weight[RIGHT] : e1->weight[LEFT])
-			 < (e2->direction == RIGHT ? e2->weight[RIGHT] : e2->weight[LEFT]);
-		// return (std::min(e1->weight[RIGHT], e1->weight[LEFT])
-		// 	  < std::min(e2->weight[RIGHT], e2->weight[LEFT]));
-	};
-
-	// Awful syntax, but declares edges to be a set of edge pointers guaranteed
-	// to be sorted in non-decreasing order by weight. Add all the edges to it
-	// and they will be automatically sorted.
-	std::set<const Edge *, decltype(edgeComparator)> edges(edgeComparator);
-	for (const Edge *e : allEdges()) {
-		// std::cout << e->vertex[LEFT] << " " << e->vertex[RIGHT] << "\n";
-		edges.insert(e);
+	const CSR &graph = frozen();
+	if (method == AUTO) {
+		size_t pairs = (graph.vertices - 1) * (graph.vertices - 2) / 2;
+		method = graph.edges >= pairs / PRIM_DENSITY ? PRIM : KRUSKAL;
 	}
 
-	std::vector<size_t> disjointSet(edgeList.size());
-	for (size_t i = 0; i < disjointSet.size(); ++i) {
-		disjointSet[i] = i;
+	// Edges are taken lightest first, in Lighter order, until the forest
+	// spans every vertex
+	std::vector<TreeEdge> forest;
+	if (method == PRIM) {
+		primForest(forest);
+	} else {
+		DisjointSets sets(graph.vertices);
+		std::vector<size_t> taken;
+		const size_t spanning = graph.vertices - 2;
+		if (method == FILTER_KRUSKAL) {
+			std::vector<size_t> edges(graph.edges);
+			for (size_t e = 0; e < graph.edges; ++e) {
+				edges[e] = e;
+			}
+			std::mt19937 random(graph.edges);
+			filterKruskal(edges.data(), edges.data() + edges.size(), graph.weight, graph.from, graph.to,
+					spanning, sets, taken, random);
+		} else if (method == BORUVKA) {
+			taken = boruvka(graph.vertices, graph.edges, graph.weight, graph.from, graph.to, threads);
+		} else {
+			std::vector<size_t> order = sortEdges(graph.weight, graph.from, graph.to, graph.edges, threads);
+			kruskal(order.data(), order.data() + order.size(), graph.from, graph.to, spanning, sets, taken);
+		}
+		for (size_t e : taken) {
+			TreeEdge edge = { std::min(graph.from[e], graph.to[e]), std::max(graph.from[e], graph.to[e]), graph.weight[e] };
+			forest.push_back(edge);
+		}
 	}
 
-	std::map<size_t, std::vector<const Edge *>> components;
-
-	while (!edges.empty()) {
-		// Because the edges set is always sorted (because we gave it a custom
-		// comparator, edges.front() is guaranteed to return the minimum weight
-		// edge);
-		const Edge *e = *edges.begin();
-		edges.erase(e);
+	writeForest(outfile, forest);
+	return true;
+}
 
-		int v1, v2;
-		if (e->direction == RIGHT) {
-			v1 = e->vertex[RIGHT];
-			v2 = e->vertex[LEFT];
-		} else {
-			v1 = e->vertex[LEFT];
-			v2 = e->vertex[RIGHT];
+// Prim's algorithm from the lowest vertex of each component in turn. Each
+// vertex waiting in the heap keeps the lightest edge (in Lighter order) that
+// reaches it from the tree; directed edges are followed both ways.
+void Graph::primForest(std::vector<TreeEdge> &forest) const {
+	const size_t vertices = csr.vertices;
+	std::vector<double> weight(vertices);
+	std::vector<int> via(vertices);
+	std::vector<bool> done(vertices, false);
+	// The edge into v in Lighter order; a vertex's ends never tie with
+	// another's, so the edge number is never needed
+	auto lighter = [&](double w1, int a1, int b1, double w2, int a2, int b2) {
+		if (w1 != w2) {
+			return w1 < w2;
 		}
-
-		// Both nodes already belong to the same set; taking this edge would
-		// introduce a cycle.
-		if (disjointSet[v1] == disjointSet[v2]) {
+		if (std::min(a1, b1) != std::min(a2, b2)) {
+			return std::min(a1, b1) < std::min(a2, b2);
+		}
+		return std::max(a1, b1) < std::max(a2, b2);
+	};
+	auto less = [&](int u, int v) {
+		return lighter(weight[u], u, via[u], weight[v], v, via[v]);
+	};
+	VertexHeap<decltype(less)> heap(vertices, less);
+
+	auto reach = [&](const Adjacency &adj, int u) {
+		for (size_t a = adj.offset[u]; a < adj.offset[u + 1]; ++a) {
+			int v = adj.target[a];
+			if (!done[v] && (via[v] < 0 || lighter(adj.weight[a], u, v, weight[v], via[v], v))) {
+				weight[v] = adj.weight[a];
+				via[v] = u;
+				heap.push(v);
+			}
+		}
+	};
+	std::fill(via.begin(), via.end(), -1);
+	for (size_t source = 0; source < vertices; ++source) {
+		if (done[source]) {
 			continue;
 		}
-
-		// Take the union of the two sets by combining both to use the
-		// minimum representative.
-		size_t newSet = std::min(disjointSet[v1], disjointSet[v2]);
-		size_t oldSet = std::max(disjointSet[v1], disjointSet[v2]);
-		
-		for (size_t i = 0; i < disjointSet.size(); ++i) {
-			if (disjointSet[i] == oldSet) {
-				disjointSet[i] = newSet;
+		int u = source;
+		while (true) {
+			done[u] = true;
+			if (via[u] >= 0) {
+				TreeEdge edge = { std::min(u, via[u]), std::max(u, via[u]), weight[u] };
+				forest.push_back(edge);
 			}
+			reach(csr.out, u);
+			if (directed) {
+				reach(csr.in, u);
+			}
+			if (heap.empty()) {
+				break;
+			}
+			u = heap.pop();
 		}
+	}
+}
 
-		std::vector<const Edge *> component1 = components[newSet];
-		if (components.find(newSet) == components.end()) {
-			component1 = std::vector<const Edge *>();
+// Print a spanning forest: for each tree with an edge, by smallest vertex,
+// its vertices and then its edges in weight order
+void Graph::writeForest(std::ostream &outfile, std::vector<TreeEdge> &forest) const {
+	std::sort(forest.begin(), forest.end(), [](const TreeEdge &e1, const TreeEdge &e2) {
+		if (e1.weight != e2.weight) {
+			return e1.weight < e2.weight;
 		}
+		return e1.from < e2.from || (e1.from == e2.from && e1.to < e2.to);
+	});
+	const CSR &graph = csr;
+	DisjointSets sets(graph.vertices);
+	for (const TreeEdge &edge : forest) {
+		sets.join(edge.from, edge.to);
+	}
 
-		std::vector<const Edge *> component2 = components[oldSet];
-		if (components.find(oldSet) == components.end()) {
-			component2 = std::vector<const Edge *>();
-		} else {
-			components.erase(oldSet);
+	// Number the components with edges by their smallest vertex, then sort
+	// their vertices and edges into place by component, in one pass each.
+	// The forest is in weight order now, so each component's edges come
+	// out sorted.
+	std::vector<int> number(graph.vertices, -1);
+	size_t components = 0;
+	for (size_t v = 1; v < graph.vertices; ++v) {
+		int root = sets.find(v);
+		if (sets.size(root) > 1 && number[root] < 0) {
+			number[root] = components++;
 		}
-
-		std::merge(component1.begin(), component1.end(), component2.begin(),
-				   component2.end(), component1.begin(), edgeComparator);
-		
-		component1.push_back(e);
-		components[newSet] = component1;
+	}
+	std::vector<size_t> vertexStart(components + 1, 0);
+	std::vector<size_t> edgeStart(components + 1, 0);
+	for (size_t v = 1; v < graph.vertices; ++v) {
+		int root = sets.find(v);
+		if (number[root] >= 0) {
+			++vertexStart[number[root] + 1];
+		}
+	}
+	for (const TreeEdge &edge : forest) {
+		++edgeStart[number[sets.find(edge.from)] + 1];
+	}
+	for (size_t c = 0; c < components; ++c) {
+		vertexStart[c + 1] += vertexStart[c];
+		edgeStart[c + 1] += edgeStart[c];
+	}
+	std::vector<int> vertices(vertexStart[components]);
+	std::vector<TreeEdge> treeEdges(forest.size());
+	std::vector<size_t> vertexFill(vertexStart.begin(), vertexStart.end() - 1);
+	std::vector<size_t> edgeFill(edgeStart.begin(), edgeStart.end() - 1);
+	for (size_t v = 1; v < graph.vertices; ++v) {
+		int root = sets.find(v);
+		if (number[root] >= 0) {
+			vertices[vertexFill[number[root]]++] = v;
+		}
+	}
+	for (const TreeEdge &edge : forest) {
+		treeEdges[edgeFill[number[sets.find(edge.from)]]++] = edge;
 	}
 
-	for (const std::pair<size_t, std::vector<const Edge *>> &component : components) {
+	for (size_t c = 0; c < components; ++c) {
 		outfile << "{ {";
-
-		bool printed = false;
-		for (size_t i = 1; i < disjointSet.size(); ++i) {
-			if (disjointSet[i] == component.first) {
-				if (printed) {
-					outfile << ", ";	
-				} else {
-					printed = true;
-				}
-
-				outfile << i;
+		for (size_t i = vertexStart[c]; i < vertexStart[c + 1]; ++i) {
+			if (i > vertexStart[c]) {
+				outfile << ", ";
 			}
+			outfile << vertices[i];
 		}
 
 		outfile << "}, { ";
-		for (size_t i = 0; i < component.second.size(); ++i) {
-			const Edge *e = component.second[i];
-			outfile << "(" << e->vertex[LEFT] << ", " << e->vertex[RIGHT] << ", ";
-			if (e->direction == RIGHT) {
-				outfile << e->weight[RIGHT];
-			} else {
-				outfile << e->weight[LEFT];
-			}
+		for (size_t i = edgeStart[c]; i < edgeStart[c + 1]; ++i) {
+			const TreeEdge &edge = treeEdges[i];
+			outfile << "(" << edge.from << ", " << edge.to << ", " << edge.weight;
 
-			if (i < component.second.size() - 1) {
+			if (i < edgeStart[c + 1] - 1) {
 				outfile << "), ";
 			}
 		}
 
 		outfile << ") } }\n";
 	}
-
-	return true;
 }
 		
 // * Step Away - print the nodes who are a degree of
@@ -787,58 +4029,25 @@ void Graph::stepAway(int source, int closeness, std::string file) {
 		throw ("Could not open output file for writing");
 	}
 
-	std::vector<bool> visited(edgeList.size(), 0);
-	std::queue<int> currentQueue;
-	std::queue<int> nextQueue;
-	
-	currentQueue.push(source);
-	visited[source] = true;
-
-	int degree = 0;
-
-	while (!currentQueue.empty()) {
-		while (!currentQueue.empty()) {
-			int current = currentQueue.front();
-			currentQueue.pop();
-				
-			Edge *e = edgeList[current];
-			while (e) {
-
-				if (e->vertex[LEFT] == current) {
-					if (!visited[e->vertex[RIGHT]] && e->direction != RIGHT) {
-						nextQueue.push(e->vertex[RIGHT]);
-						visited[e->vertex[RIGHT]] = true;
-					}
-					e = e->link[LEFT];
-				} else if (e->vertex[RIGHT] == current) {
-					if (!visited[e->vertex[LEFT]] && e->direction != LEFT) {
-						nextQueue.push(e->vertex[LEFT]);
-						visited[e->vertex[LEFT]] = true;
-					}
-					e = e->link[RIGHT];
-				}
+	const CSR &graph = frozen();
+	WorkspaceLease ws(*this);
+	ws->begin(graph.vertices);
+	size_t unexploredArcs = arcCount(false);
+	levelSearch(*ws, source, false, unexploredArcs, [&](const std::vector<int> &level, int degree) {
+		if (closeness > 0 && degree == closeness) {
+			for (int node : level) {
+				outfile << node << "\n";
 			}
+			return true;
 		}
-
-		++degree;
-		currentQueue = nextQueue;
-		nextQueue = std::queue<int> ();
-		if (degree == closeness) {
-			break;
-		}
-	}
+		return false;
+	});
 
 	if (closeness == -1) {
-		for (size_t i = 1; i < visited.size(); ++i) {
-			if (!visited[i]) {
+		for (size_t i = 1; i < graph.vertices; ++i) {
+			if (!ws->visited(i)) {
 				outfile << i << "\n";
 			}
 		}
-		return;
-	}
-
-	while (!currentQueue.empty()) {
-		outfile << currentQueue.front() << "\n";
-		currentQueue.pop();	
 	}
 }
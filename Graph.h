@@ -4,83 +4,401 @@
 #include <queue>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <functional>
 
 //This class will be used to create a graph library.
 enum Type {DIRECTED, UNDIRECTED};
 enum Direction {BOTH, LEFT, RIGHT};
+// How MST finds the spanning forest
+enum MSTMethod {AUTO, KRUSKAL, FILTER_KRUSKAL, BORUVKA, PRIM};
 
 class Graph {
 	private:
-		// Struct used to represent edges in edge list
+		// Struct used to represent an added edge until compile
 		struct Edge {
-			Edge(int v1, int v2, double w1, double w2, int d, Edge *l, Edge *r) {
+			Edge(int v1, int v2, double w1, double w2, int d) {
 				vertex[LEFT] = v1;
 				vertex[RIGHT] = v2;
 				weight[LEFT] = w1;
 				weight[RIGHT] = w2;
 				direction = d;
-				link[LEFT] = l;
-				link[RIGHT] = r;
 			}
 			int vertex[3];
-			Edge* link[3];
 			double weight[3];
 			size_t direction;
 		};
 	
-		std::vector<Edge*> edgeList;
-		std::set<const Graph::Edge *> allEdges(void) const;	
+		// Compressed sparse row adjacency: the neighbors of vertex v are
+		// target[offset[v]] .. target[offset[v+1]-1], sorted by vertex
+		struct Adjacency {
+			const size_t *offset;
+			const int *target;
+			const double *weight;
+		};
+
+		// Frozen form of the graph that all queries run against. Every
+		// edge is also kept once in from/to/weight (LEFT/RIGHT order for
+		// undirected graphs) for writeToFile and MST. The arrays live in
+		// storage, or in a mapped snapshot file.
+		struct CSR {
+			size_t vertices;
+			size_t edges;
+			Adjacency out;
+			// Same arrays as out for undirected graphs
+			Adjacency in;
+			const int *from;
+			const int *to;
+			const double *weight;
+		};
+
+		// Owns the CSR arrays of a graph compiled in memory
+		struct AdjacencyStorage {
+			std::vector<size_t> offset;
+			std::vector<int> target;
+			std::vector<double> weight;
+		};
+		struct CSRStorage {
+			AdjacencyStorage out;
+			AdjacencyStorage in;
+			std::vector<int> from;
+			std::vector<int> to;
+			std::vector<double> weight;
+		};
+	
+		// Number of vertex slots, counting the unused slot 0. Edges are
+		// only ever read back in the order they were added, by compile.
+		size_t slotCount;
+
+		// Edges are carved out of fixed-size slabs owned by the graph, in
+		// the order they are added, so adding one is a pointer bump and
+		// teardown frees whole slabs
+		static const size_t EDGES_PER_SLAB = 4096;
+		std::vector<Edge *> slabs;
+		Edge *allocateEdge(int v1, int v2, double w1, double w2, int d);
+		template <typename F>
+		void forEachEdge(F visit) const;
 
 		bool directed;
 		size_t number_of_edges;
 
-		void DFUndirected(int node, std::vector<int> &vlist, std::queue<int> &oList);
-		void DFDirected(int node, std::vector<int> &vlist, std::queue<int> &oList);
-		void BFUndirected(int node, std::vector<int> &vlist, std::queue<int> &oList);
-		void BFDirected(int node, std::vector<int> &vlist, std::queue<int> &oList);
-		void treeHelper(int source, std::vector<int> &vlist);
-		void sortEdges(int node);
-		void undirectedClose(int v1, std::vector<int> &distance, std::set<int> unvisited);
-		void directedClose(int v1, std::vector<int> &distance, std::set<int> unvisited);
-		void breadthFirstApply(std::vector<bool> &visited, int source, const std::function<bool(int)> &lambda, bool ignoreDirections);
+		CSR csr;
+		CSRStorage storage;
+		bool compiled;
+		// The CSR arrays are the only copy of the graph (no Edge objects)
+		bool csrOnly;
+		unsigned threads;
+
+		// Scratch space kept between queries. A vertex is marked when its
+		// mark equals the current epoch (or epoch + 1, for the second side
+		// of a bidirectional search), so a new search bumps the epoch
+		// instead of clearing an array the size of the graph.
+		struct Workspace {
+			Workspace() : epoch(0), ownerStamp(0) {}
+			void begin(size_t vertices);
+			bool visited(int v) const {
+				return mark[v] == epoch;
+			}
+			// Mark v, returning whether it was unmarked
+			bool visit(int v) {
+				if (mark[v] == epoch) {
+					return false;
+				}
+				mark[v] = epoch;
+				return true;
+			}
+			// visit for threads expanding one level together: of all the
+			// threads that reach v, exactly one gets true
+			bool claim(int v) {
+				unsigned seen = __atomic_load_n(&mark[v], __ATOMIC_RELAXED);
+				return seen != epoch && __atomic_compare_exchange_n(&mark[v], &seen, epoch, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			}
+			// Frontier bitmap for bottom-up search levels, all clear
+			// between levels
+			bool inFrontier(int v) const {
+				return frontier[v >> 6] >> (v & 63) & 1;
+			}
+			void setFrontier(int v, bool set) {
+				if (set) {
+					frontier[v >> 6] |= std::uint64_t(1) << (v & 63);
+				} else {
+					frontier[v >> 6] &= ~(std::uint64_t(1) << (v & 63));
+				}
+			}
+
+			std::vector<unsigned> mark;
+			unsigned epoch;
+			std::vector<int> queue;
+			std::vector<int> backQueue;
+			std::vector<int> next;
+			std::vector<std::uint64_t> frontier;
+			// Depth first search path: each vertex with the number of its
+			// arcs already tried
+			std::vector<std::pair<int, size_t>> stack;
+			// Multi-source search words, a bit per search, all zero
+			// between searches
+			std::vector<std::uint64_t> seenBy;
+			std::vector<std::uint64_t> frontierBy;
+			std::vector<std::uint64_t> nextBy;
+			// Per-thread pieces of the next level in a parallel search
+			std::vector<std::vector<int>> pieces;
+			// Lowest frontier position reaching each vertex in a parallel
+			// top-down level, under the level's stamp in the high half
+			std::vector<std::uint64_t> owner;
+			std::uint32_t ownerStamp;
+			// Point-to-point search labels, meaningful for the vertices
+			// marked in the current epoch
+			std::vector<double> cost;
+			std::vector<double> bound;
+			std::vector<int> parent;
+		};
+		// Workspaces not lent out at the moment. A query borrows one for
+		// as long as it runs, so queries on different threads (once the
+		// graph is compiled) never share one.
+		std::vector<std::unique_ptr<Workspace>> idleWorkspaces;
+		std::mutex workspaceLock;
+		class WorkspaceLease {
+			public:
+				explicit WorkspaceLease(Graph &g);
+				~WorkspaceLease();
+				Workspace &operator*() { return *ws; }
+				Workspace *operator->() { return ws.get(); }
+			private:
+				Graph &graph;
+				std::unique_ptr<Workspace> ws;
+		};
+		int hopDistance(int v1, int v2, Workspace &ws) const;
+		double tuneDelta() const;
+		bool dijkstra(const Adjacency &adj, int source, std::vector<double> &distance, std::vector<int> &predecessor,
+				int target);
+		// ALT landmarks and, vertex by vertex, the distance from each
+		// landmark to the vertex and (directed graphs) back. Dropped
+		// whenever the graph is rebuilt.
+		std::vector<int> landmarks;
+		std::vector<double> landmarkFrom;
+		std::vector<double> landmarkTo;
+		void dropLandmarks();
+		double landmarkBound(int v, const double *targetFrom, const double *targetTo) const;
+		// Contraction hierarchy: each vertex's rank in the order vertices
+		// were contracted, its arcs to higher ranked vertices (up) and the
+		// arcs into it from them (down), with the vertex each shortcut
+		// bypasses (-1 for an edge of the graph). Arcs are sorted by the
+		// vertex at their other end. Dropped whenever the graph is rebuilt.
+		struct Hierarchy {
+			std::vector<int> rank;
+			AdjacencyStorage up;
+			AdjacencyStorage down;
+			std::vector<int> upMiddle;
+			std::vector<int> downMiddle;
+		};
+		Hierarchy hierarchy;
+		bool hierarchyPath(int source, int target, double &distance, std::vector<int> &path);
+		int hierarchyMiddle(int from, int to) const;
+		// Hub labels (pruned landmark labeling): for each vertex, the hubs
+		// it reaches (out) and the hubs that reach it (in) with their hop
+		// distances, sorted by hub rank, so that closeness is a merge of
+		// two runs. The runs are flat arrays, held in storage or in a
+		// mapped label file. Dropped whenever the graph is rebuilt.
+		struct HubLabel {
+			std::uint32_t hub;
+			std::uint32_t hops;
+		};
+		struct LabelRuns {
+			const size_t *offset;
+			const HubLabel *label;
+		};
+		struct HubLabels {
+			// 0 when there are no labels
+			size_t vertices;
+			LabelRuns out;
+			// Same arrays as out for undirected graphs
+			LabelRuns in;
+		};
+		struct LabelStorage {
+			std::vector<size_t> offset;
+			std::vector<HubLabel> label;
+		};
+		HubLabels hubLabels;
+		LabelStorage hubOut;
+		LabelStorage hubIn;
+		void *labelMapping;
+		size_t labelMappingLength;
+		void dropHubLabels();
+		int labelDistance(int v1, int v2) const;
+		template <typename F>
+		void multiSourceSearch(Workspace &ws, const int *sources, size_t count, int maxDepth, F onReach) const;
+		template <typename F>
+		void searchBatches(const std::vector<int> &sources, int maxDepth, F onBatch);
+		static size_t frontierArcs(const std::vector<int> &frontier, const Adjacency &adj);
+
+		// Read-only mapping of the snapshot the graph was loaded from, if any
+		void *mapping;
+		size_t mappingLength;
+		void unmap();
+		// Copy a CSR-only graph back into edges so it can be changed
+		void thaw();
+		size_t vertexSlots() const;
+
+		const CSR &frozen();
+		void buildCSR(size_t vertices);
+		static Adjacency buildAdjacency(AdjacencyStorage &adj, size_t vertices, const std::vector<int> &tail,
+				const std::vector<int> &head, const std::vector<double> &cost, unsigned threads);
+		template <typename F>
+		void forEachNeighbor(int node, bool ignoreDirections, F visit) const;
+
+		std::vector<int> componentRoots() const;
+		std::vector<int> strongRoots();
+		void trimSingletons(std::vector<int> &root) const;
+		std::vector<int> reachAll(Workspace &ws, int source, const Adjacency &adj) const;
+		bool checkForest(std::vector<int> &roots, size_t maxRoots);
+		template <typename F>
+		void depthSearch(Workspace &ws, int source, bool ignoreDirections, F onFinish) const;
+		size_t degree(int node, bool ignoreDirections) const;
+		size_t arcCount(bool ignoreDirections) const;
+		template <typename F>
+		void levelSearch(Workspace &ws, int source, bool ignoreDirections, size_t &unexploredArcs, F onLevel) const;
+		// An edge of a spanning forest, from its lower end vertex
+		struct TreeEdge {
+			int from;
+			int to;
+			double weight;
+		};
+		void primForest(std::vector<TreeEdge> &forest) const;
+		void writeForest(std::ostream &outfile, std::vector<TreeEdge> &forest) const;
+		template <typename F>
+		size_t parallelLevel(Workspace &ws, size_t work, unsigned workers, std::vector<int> &next, F expand) const;
 	public:
 		// Construct an empty graph of the specified type
 		Graph(Type t);
 		// Delete a graph
 		~Graph();
+		// Graphs own their edges and are not copyable
+		Graph(const Graph &) = delete;
+		Graph &operator=(const Graph &) = delete;
 		// Read a graph from a file
 		void readFromFile(std::string file);
+		// Read a graph from a file, parsing and building it on all of the
+		// graph's threads. Falls back to readFromFile if not empty.
+		void readFromFileParallel(std::string file);
+		// Number of threads used by the parallel loader and algorithms
+		// (defaults to the number of hardware threads)
+		void setThreads(unsigned count);
 		// Write a graph to a file
 		void writeToFile(std::string file);
+		// Write the compiled graph to a binary snapshot file (return
+		// whether or not this operation was successful)
+		bool writeSnapshot(std::string file);
+		// Replace the graph with a snapshot written by writeSnapshot.
+		// The file is mapped and queried in place, without parsing.
+		bool mapSnapshot(std::string file);
 		// Empty
 		bool empty();
 		// Add edge
 		void addEdge(int v1, int v2, double weight);
 		// Add vertex
 		void addVertex();
+		// Freeze the graph into its CSR form. Queries do this on demand
+		// after the graph changes; call it up front to pay the cost once.
+		void compile();
 		// Count connected components
 		int numConnectedComponents();
-		// Tree check
+		// Connected components - the component of every node, numbered
+		// from 0 in order of their smallest nodes (-1 for the unused slot
+		// 0), with sizes set to the number of nodes in each. Directed edges
+		// join nodes either way.
+		std::vector<int> components(std::vector<int> &sizes);
+		// Strongly connected components - numbered the same way, but two
+		// nodes only share one when each can reach the other
+		std::vector<int> strongComponents(std::vector<int> &sizes);
+		// Tree check. A directed tree has one root and every other node
+		// has one edge in.
 		bool tree();
+		// Forest check - whether every component is a tree, with roots
+		// set to one root per tree (the smallest node of each, when
+		// undirected)
+		bool forest(std::vector<int> &roots);
 		// Depth First Traverse - proceed from source
 		void DFT(int source, std::string file);
-		// Breadth First Traverse - proceed from source
+		// Breadth First Traverse - proceed from source. On large graphs
+		// nodes at the same depth may be listed in vertex order.
 		void BFT(int source, std::string file);
 		// Closeness - determine minimum number of edges to get
-		// from one node to the other
+		// from one node to the other (answered from hub labels once
+		// buildHubLabels or mapHubLabels has set them)
 		int closeness(int v1, int v2);
+		// Closeness for each (v1, v2) pair, in order
+		std::vector<int> closeness(const std::vector<std::pair<int, int>> &pairs);
+		// Closeness from each source to every node (-1 where it cannot be
+		// reached), searching 64 sources at a time
+		std::vector<std::vector<int>> closeness(const std::vector<int> &sources);
+		// Shortest paths - the least total weight from source to every
+		// node, following directed edges forwards only, and the node
+		// before each on such a path (infinity and -1 for nodes out of
+		// reach; -1 for the source). With a target, the search stops as
+		// soon as the target's distance is known. Edge weights must not
+		// be negative; false if the search met one.
+		bool shortestPaths(int source, std::vector<double> &distance, std::vector<int> &predecessor, int target = -1);
+		// Shortest paths on the graph's threads by delta-stepping, with
+		// distances grouped into buckets delta wide. A delta of 0 is picked
+		// from the graph's weights.
+		bool shortestPathsParallel(int source, std::vector<double> &distance, std::vector<int> &predecessor,
+				double delta = 0);
+		// Shortest path from source to target - its total weight
+		// (infinity out of reach) and its nodes from source to target
+		// (none out of reach). Searches the contraction hierarchy once
+		// buildHierarchy or readHierarchy has set one, and otherwise runs
+		// A*, guided by landmarks when buildLandmarks or readLandmarks has
+		// set them. False if the search met a negative edge weight.
+		bool shortestPath(int source, int target, double &distance, std::vector<int> &path);
+		// Pick count landmarks for shortestPath, each as far as possible
+		// from those before it, and store the distances to and from them
+		// (return whether or not this operation was successful)
+		bool buildLandmarks(unsigned count = 16);
+		// Write the landmarks to a binary file kept next to the graph
+		bool writeLandmarks(std::string file);
+		// Read landmarks written by writeLandmarks for this same graph
+		bool readLandmarks(std::string file);
+		// Contract the nodes one at a time, least useful first, adding a
+		// shortcut wherever that removes the only shortest path between
+		// two of its neighbors, so that shortestPath need only search up
+		// the order from both ends (return whether or not this operation
+		// was successful)
+		bool buildHierarchy();
+		// Write the contraction hierarchy to a binary file kept next to
+		// the graph
+		bool writeHierarchy(std::string file);
+		// Read a hierarchy written by writeHierarchy for this same graph
+		bool readHierarchy(std::string file);
+		// Label every node with hubs on its shortest paths, pruning each
+		// hub's breadth first search where earlier hubs already cover it,
+		// so closeness needs no search. Hubs are taken busiest first,
+		// several at a time across the graph's threads.
+		void buildHubLabels();
+		// Write the hub labels to a binary file kept next to the graph
+		bool writeHubLabels(std::string file);
+		// Use hub labels written by writeHubLabels for this same graph,
+		// mapped and read in place
+		bool mapHubLabels(std::string file);
 		// * Partition - determine if you can partition the graph
 		bool partitionable();
 		// * MST - print the minimum spanning tree of the graph
 		// to a file with the passed name (return whether or not
-        // this operation was successful)
-		bool MST(std::string file);
+        // this operation was successful). Every method writes the same
+		// forest; FILTER_KRUSKAL skips sorting most of the edges when the
+		// forest needs only a few of them, BORUVKA grows every tree at
+		// once across the graph's threads, and PRIM suits dense graphs.
+		// AUTO picks PRIM or KRUSKAL by the graph's density.
+		bool MST(std::string file, MSTMethod method = AUTO);
 		// * Step Away - print the nodes who are a degree of
 		// closeness from the source to a file with the passed name
 		void stepAway(int source, int closeness, std::string file);
+		// Step Away for each source, with the nodes for each in order
+		std::vector<std::vector<int>> stepAway(const std::vector<int> &sources, int closeness);
 };
 
 #endif 
@@ -2,8 +2,35 @@
 #define CATCH_CONFIG_CPP11_NULLPTR
 #include "Graph.h"
 #include "catch.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <random>
 #include <sstream>
+#include <utility>
+#include <vector>
 
+namespace {
+std::string fileContents(const std::string &file) {
+	std::ifstream in(file);
+	std::stringstream contents;
+	contents << in.rdbuf();
+	return contents.str();
+}
+
+// Copies a binary file with the value at position overwritten, counting
+// back from the end when position is negative
+template <typename T>
+void corruptCopy(const std::string &from, const std::string &to, long position, T value) {
+	std::string contents = fileContents(from);
+	size_t at = position < 0 ? contents.size() + position : position;
+	contents.replace(at, sizeof(value), reinterpret_cast<const char *>(&value), sizeof(value));
+	std::ofstream out(to, std::ios::binary);
+	out << contents;
+}
+}
 
 TEST_CASE("readFromFile(std::string file)", "File input") {
 	Graph G(DIRECTED);
@@ -15,6 +42,87 @@ TEST_CASE("readFromFile(std::string file)", "File input") {
 	G.BFT(2, "g1-bft2.txt");
 }
 
+TEST_CASE("readFromFile(std::string file) large input", "Block parsing") {
+	// Enough lines to cross the reader's block size, with CRLF endings,
+	// tabs, exponents and no newline at the end of the file
+	const int n = 120000;
+	{
+		std::ofstream out("test_large-input.txt");
+		out << "undirected\r\n" << n << "\r\n" << n - 1 << "\r\n";
+		for (int i = 1; i < n; ++i) {
+			out << i << "\t" << i + 1 << " ";
+			if (i % 3 == 0) {
+				out << i << "e-2";
+			} else {
+				out << i * 0.25;
+			}
+			out << (i + 1 < n ? "\r\n" : "");
+		}
+	}
+
+	Graph G(DIRECTED);
+	G.readFromFile("test_large-input.txt");
+	REQUIRE(G.numConnectedComponents() == 1);
+	G.writeToFile("test_large-output.txt");
+
+	std::ifstream in("test_large-output.txt");
+	std::string type;
+	size_t vertices = 0, edges = 0;
+	in >> type >> vertices >> edges;
+	REQUIRE(type == "undirected");
+	REQUIRE(vertices == n);
+	REQUIRE(edges == n - 1);
+	int read = 0, mismatched = 0;
+	int v1, v2;
+	double weight;
+	while (in >> v1 >> v2 >> weight) {
+		++read;
+		double expected = read % 3 == 0 ? read / 100.0 : read * 0.25;
+		if (v1 != read || v2 != read + 1 || weight != Approx(expected)) {
+			++mismatched;
+		}
+	}
+	REQUIRE(read == n - 1);
+	REQUIRE(mismatched == 0);
+}
+
+TEST_CASE("readFromFileParallel(std::string file)", "Parallel loading") {
+	// A directed graph big enough to be split across threads, with parallel
+	// edges and a malformed line near the end
+	const int n = 50000;
+	{
+		std::ofstream out("test_large-parallel.txt");
+		out << "directed\n" << n << "\n" << 3 * n << "\n";
+		for (long long i = 1; i <= 3 * n; ++i) {
+			out << (i * 7919) % n + 1 << " " << (i * 104729) % n + 1 << " " << i % 97 * 0.5 << "\n";
+			if (i == 3 * n - 10) {
+				out << "12 x 1.0\n";
+			}
+		}
+	}
+
+	Graph serial(DIRECTED);
+	serial.readFromFile("test_large-parallel.txt");
+	serial.writeToFile("test_large-serial-output.txt");
+	serial.BFT(1, "test_large-serial-bft.txt");
+
+	Graph parallel(UNDIRECTED);
+	parallel.setThreads(4);
+	parallel.readFromFileParallel("test_large-parallel.txt");
+	parallel.writeToFile("test_large-parallel-output.txt");
+	parallel.BFT(1, "test_large-parallel-bft.txt");
+
+	REQUIRE(fileContents("test_large-parallel-output.txt") == fileContents("test_large-serial-output.txt"));
+	REQUIRE(fileContents("test_large-parallel-bft.txt") == fileContents("test_large-serial-bft.txt"));
+	REQUIRE(parallel.numConnectedComponents() == serial.numConnectedComponents());
+
+	Graph small(DIRECTED);
+	small.readFromFileParallel("g2.txt");
+	REQUIRE(small.closeness(7, 3) == 2);
+	small.addEdge(3, 7, 1.0);
+	REQUIRE(small.closeness(3, 7) == 1);
+}
+
 TEST_CASE("empty()", "Empty graph") {
 	Graph G(DIRECTED);
 	REQUIRE(G.empty());
@@ -56,6 +164,98 @@ TEST_CASE("addEdge(int v1, int v2, double weight)", "Add graph edge") {
 	GG.writeToFile("test_add-edge.txt");
 }
 
+TEST_CASE("compile()", "Freeze into CSR") {
+	Graph G(UNDIRECTED);
+	G.readFromFile("g1.txt");
+	G.compile();
+	REQUIRE(G.numConnectedComponents() == 2);
+	REQUIRE(G.closeness(1, 5) == 2);
+	REQUIRE(G.closeness(1, 6) == -1);
+
+	// Changing the graph invalidates the frozen form
+	G.addEdge(1, 3, 1.5);
+	REQUIRE(G.numConnectedComponents() == 1);
+	REQUIRE(G.closeness(1, 6) == 2);
+
+	Graph G2(DIRECTED);
+	G2.readFromFile("g2.txt");
+	G2.compile();
+	REQUIRE(G2.closeness(7, 3) == 2);
+	REQUIRE(G2.closeness(3, 7) == -1);
+}
+
+TEST_CASE("mapSnapshot(std::string file)", "Binary snapshot") {
+	Graph G(UNDIRECTED);
+	G.readFromFile("g1.txt");
+	REQUIRE(G.writeSnapshot("test_g1.snapshot"));
+	G.writeToFile("test_g1-text.txt");
+	G.DFT(1, "test_g1-dft.txt");
+
+	Graph M(DIRECTED);
+	REQUIRE(M.mapSnapshot("test_g1.snapshot"));
+	REQUIRE(!M.empty());
+	REQUIRE(M.numConnectedComponents() == 2);
+	REQUIRE(!M.partitionable());
+	M.writeToFile("test_g1-mapped.txt");
+	REQUIRE(fileContents("test_g1-mapped.txt") == fileContents("test_g1-text.txt"));
+	M.DFT(1, "test_g1-mapped-dft.txt");
+	REQUIRE(fileContents("test_g1-mapped-dft.txt") == fileContents("test_g1-dft.txt"));
+
+	// Changing a mapped graph copies it back into edges first
+	M.addEdge(1, 3, 1.5);
+	REQUIRE(M.numConnectedComponents() == 1);
+
+	Graph G2(DIRECTED);
+	G2.readFromFile("g2.txt");
+	REQUIRE(G2.writeSnapshot("test_g2.snapshot"));
+	Graph M2(UNDIRECTED);
+	REQUIRE(M2.mapSnapshot("test_g2.snapshot"));
+	REQUIRE(M2.closeness(7, 3) == 2);
+	REQUIRE(M2.closeness(3, 7) == -1);
+	REQUIRE(M2.MST("test_g2-mapped-mst.txt"));
+	REQUIRE(fileContents("test_g2-mapped-mst.txt") == fileContents("g2-mst.txt"));
+
+	Graph bad(UNDIRECTED);
+	REQUIRE_FALSE(bad.mapSnapshot("g1.txt"));
+	REQUIRE_FALSE(bad.mapSnapshot("missing.snapshot"));
+	REQUIRE(bad.empty());
+
+	// Both loaders take vertices from 1 up to past the declared count and
+	// stop at vertex 0, and whatever they load maps back
+	{
+		std::ofstream out("test_g-boundary.txt");
+		out << "directed\n5\n4\n1 5 1.5\n5 1 2\n7 1 0.5\n0 3 1\n";
+	}
+	Graph serialBoundary(DIRECTED), parallelBoundary(DIRECTED);
+	serialBoundary.readFromFile("test_g-boundary.txt");
+	parallelBoundary.readFromFileParallel("test_g-boundary.txt");
+	serialBoundary.writeToFile("test_g-boundary-serial.txt");
+	parallelBoundary.writeToFile("test_g-boundary-parallel.txt");
+	REQUIRE(fileContents("test_g-boundary-serial.txt") == "directed\n7\n3\n1 5 1.5\n5 1 2\n7 1 0.5\n");
+	REQUIRE(fileContents("test_g-boundary-parallel.txt") == fileContents("test_g-boundary-serial.txt"));
+	REQUIRE(parallelBoundary.writeSnapshot("test_g-boundary.snapshot"));
+	Graph mappedBoundary(DIRECTED);
+	REQUIRE(mappedBoundary.mapSnapshot("test_g-boundary.snapshot"));
+	mappedBoundary.writeToFile("test_g-boundary-mapped.txt");
+	REQUIRE(fileContents("test_g-boundary-mapped.txt") == fileContents("test_g-boundary-serial.txt"));
+	Graph zero(DIRECTED);
+	zero.addVertex();
+	zero.addEdge(0, 2, 1.0);
+	REQUIRE_FALSE(zero.writeSnapshot("test_g-boundary.snapshot"));
+
+	// The offsets follow the 56 byte header, and the last edge's head ends
+	// the file
+	corruptCopy("test_g1.snapshot", "test_bad.snapshot", 56, (std::uint64_t)1);
+	REQUIRE_FALSE(M2.mapSnapshot("test_bad.snapshot"));
+	corruptCopy("test_g1.snapshot", "test_bad.snapshot", 64 + 8 * 3, (std::uint64_t)0);
+	REQUIRE_FALSE(M2.mapSnapshot("test_bad.snapshot"));
+	corruptCopy("test_g1.snapshot", "test_bad.snapshot", -4, (std::int32_t)1000);
+	REQUIRE_FALSE(M2.mapSnapshot("test_bad.snapshot"));
+	corruptCopy("test_g1.snapshot", "test_bad.snapshot", 24, (std::uint64_t)-1);
+	REQUIRE_FALSE(M2.mapSnapshot("test_bad.snapshot"));
+	// A rejected file leaves the mapped graph alone
+	REQUIRE(M2.closeness(7, 3) == 2);
+}
 
 TEST_CASE("tree()", "Is tree") {
 	Graph G(UNDIRECTED);
@@ -87,6 +287,44 @@ TEST_CASE("tree()", "Is tree") {
 	Graph G2(DIRECTED);
 	G2.readFromFile("g2.txt");
 	REQUIRE(!G2.tree());
+
+	// Two edges into one node make a tree undirected, but not directed
+	Graph V(DIRECTED);
+	V.addVertex();
+	V.addEdge(1, 2, 1.0);
+	V.addEdge(3, 2, 1.0);
+	REQUIRE(!V.tree());
+}
+
+TEST_CASE("forest(std::vector<int> &roots)", "Is forest") {
+	Graph G(UNDIRECTED);
+	G.addVertex();
+	G.addEdge(2, 1, 1.0);
+	G.addEdge(3, 4, 1.0);
+	G.addEdge(5, 4, 1.0);
+	G.addVertex();
+	std::vector<int> roots;
+	REQUIRE(G.forest(roots));
+	REQUIRE(roots == std::vector<int>({1, 3, 6}));
+	REQUIRE(!G.tree());
+	G.addEdge(3, 5, 1.0);
+	REQUIRE(!G.forest(roots));
+
+	Graph DG(DIRECTED);
+	DG.addVertex();
+	DG.addEdge(2, 1, 1.0);
+	DG.addEdge(2, 3, 1.0);
+	DG.addEdge(5, 4, 1.0);
+	REQUIRE(DG.forest(roots));
+	REQUIRE(roots == std::vector<int>({2, 5}));
+	// A cycle off to the side, with every in-degree still one
+	DG.addEdge(6, 7, 1.0);
+	DG.addEdge(7, 6, 1.0);
+	REQUIRE(!DG.forest(roots));
+
+	Graph G1(UNDIRECTED);
+	G1.readFromFile("g1.txt");
+	REQUIRE(!G1.forest(roots));
 }
 
 TEST_CASE("DFT(int, std::string)", "Depth Frist Traverse") {
@@ -100,6 +338,23 @@ TEST_CASE("DFT(int, std::string)", "Depth Frist Traverse") {
 	G2.writeToFile("g2_output.txt");
 	G2.DFT(2, "g2-dft2.txt");
 	G2.DFT(4, "g2-dft4.txt");
+
+	// A path far deeper than the call stack would allow for recursion
+	const int n = 500000;
+	Graph path(UNDIRECTED);
+	path.addVertex();
+	for (int i = 1; i < n; ++i) {
+		path.addEdge(i, i + 1, 1.0);
+	}
+	path.DFT(1, "test_large-dft.txt");
+	std::ifstream in("test_large-dft.txt");
+	int node, expected = n, wrong = 0;
+	while (in >> node) {
+		wrong += node != expected--;
+	}
+	REQUIRE(wrong == 0);
+	REQUIRE(expected == 0);
+	REQUIRE(path.tree());
 }
 
 TEST_CASE("BFT(int, std::string)", "Breadth Frist Traverse") {
@@ -114,6 +369,116 @@ TEST_CASE("BFT(int, std::string)", "Breadth Frist Traverse") {
 	G2.BFT(7, "g2-bft7.txt");
 }
 
+TEST_CASE("BFT(int, std::string) on a large graph", "Direction-optimizing traversal") {
+	// Large and dense enough that the middle levels are searched bottom-up
+	const int n = 20000;
+	Graph G(DIRECTED);
+	G.addVertex();
+	std::mt19937 random(240);
+	for (int i = 0; i < 8 * n; ++i) {
+		G.addEdge(random() % n + 1, random() % n + 1, 1.0);
+	}
+	G.addVertex();
+
+	// Every node is listed once, in order of distance from the source
+	G.BFT(1, "test_large-bft.txt");
+	std::ifstream in("test_large-bft.txt");
+	std::vector<int> seen(n + 2, 0);
+	int node, listed = 0, outOfOrder = 0, previous = 0;
+	while (in >> node) {
+		++listed;
+		++seen[node];
+		int distance = G.closeness(1, node);
+		outOfOrder += distance < previous;
+		previous = distance;
+	}
+	int reachable = 0;
+	for (int v = 1; v <= n + 1; ++v) {
+		reachable += G.closeness(1, v) >= 0;
+	}
+	REQUIRE(listed == reachable);
+	REQUIRE(outOfOrder == 0);
+	REQUIRE(std::count(seen.begin(), seen.end(), 1) == listed);
+
+	// Each step away is exactly the nodes at that distance
+	for (int steps = 1; steps <= 3; ++steps) {
+		G.stepAway(1, steps, "test_large-stepaway.txt");
+		std::ifstream level("test_large-stepaway.txt");
+		int count = 0, wrong = 0;
+		while (level >> node) {
+			++count;
+			wrong += G.closeness(1, node) != steps;
+		}
+		int expected = 0;
+		for (int v = 1; v <= n + 1; ++v) {
+			expected += G.closeness(1, v) == steps;
+		}
+		REQUIRE(wrong == 0);
+		REQUIRE(count == expected);
+	}
+
+	// The extra vertex is on its own
+	REQUIRE(G.numConnectedComponents() == 2);
+}
+
+TEST_CASE("setThreads(unsigned) for searches", "Level-synchronous parallel traversal") {
+	// The same bipartite graph on one and on four threads: even nodes
+	// only link to odd ones, and a second half is left unreachable
+	const int n = 40000;
+	Graph serial(UNDIRECTED), parallel(UNDIRECTED);
+	serial.setThreads(1);
+	parallel.setThreads(4);
+	serial.addVertex();
+	parallel.addVertex();
+	std::mt19937 random(1010);
+	for (int i = 0; i < 6 * n; ++i) {
+		int v1 = 2 * (random() % (n / 4)) + 1;
+		int v2 = 2 * (random() % (n / 4)) + 2;
+		serial.addEdge(v1, v2, 1.0);
+		parallel.addEdge(v1, v2, 1.0);
+	}
+	for (int v = n / 2 + 1; v <= n; ++v) {
+		serial.addVertex();
+		parallel.addVertex();
+	}
+
+	// Levels come out in the same order however many threads share them
+	serial.BFT(1, "test_large-bft.txt");
+	parallel.BFT(1, "test_large-bft-parallel.txt");
+	REQUIRE(fileContents("test_large-bft-parallel.txt") == fileContents("test_large-bft.txt"));
+	for (int steps = 2; steps <= 4; ++steps) {
+		serial.stepAway(1, steps, "test_large-stepaway.txt");
+		parallel.stepAway(1, steps, "test_large-stepaway-parallel.txt");
+		REQUIRE(fileContents("test_large-stepaway-parallel.txt") == fileContents("test_large-stepaway.txt"));
+	}
+
+	// Too few vertices to go bottom-up, so every big level is split top-down
+	// across the threads, whose timing must not show in the output
+	Graph dense(UNDIRECTED);
+	dense.addVertex();
+	for (int i = 0; i < 200000; ++i) {
+		dense.addEdge(random() % 3000 + 1, random() % 3000 + 1, 1.0);
+	}
+	dense.setThreads(1);
+	dense.BFT(1, "test_large-bft.txt");
+	dense.setThreads(8);
+	int differing = 0;
+	for (int run = 0; run < 10; ++run) {
+		dense.BFT(1, "test_large-bft-parallel.txt");
+		differing += fileContents("test_large-bft-parallel.txt") != fileContents("test_large-bft.txt");
+	}
+	REQUIRE(differing == 0);
+
+	REQUIRE(parallel.numConnectedComponents() == serial.numConnectedComponents());
+	REQUIRE(parallel.partitionable());
+
+	// One edge between two odd nodes closes an odd cycle
+	serial.addEdge(1, 3, 1.0);
+	parallel.addEdge(1, 3, 1.0);
+	REQUIRE_FALSE(serial.partitionable());
+	REQUIRE_FALSE(parallel.partitionable());
+}
+
 TEST_CASE("numConnectedComponents()", "Number of Connected Components") {
 	Graph G(UNDIRECTED);
 	G.readFromFile("g1.txt");
@@ -124,6 +489,559 @@ TEST_CASE("numConnectedComponents()", "Number of Connected Components") {
 	REQUIRE(G2.numConnectedComponents() == 1);
 }
 
+TEST_CASE("components(std::vector<int> &sizes)", "Component labels") {
+	Graph G(UNDIRECTED);
+	G.readFromFile("g1.txt");
+	std::vector<int> sizes;
+	REQUIRE(G.components(sizes) == std::vector<int>({-1, 0, 0, 1, 0, 0, 1}));
+	REQUIRE(sizes == std::vector<int>({4, 2}));
+
+	// Afforest on four threads labels a sparse random graph, with many
+	// small components beside the giant one, the same as the union-find
+	const int n = 100000;
+	Graph serial(DIRECTED), parallel(DIRECTED);
+	parallel.setThreads(4);
+	serial.addVertex();
+	parallel.addVertex();
+	std::mt19937 random(1018);
+	for (int i = 0; i < n * 6 / 10; ++i) {
+		int v1 = random() % n + 1, v2 = random() % n + 1;
+		serial.addEdge(v1, v2, 1.0);
+		parallel.addEdge(v1, v2, 1.0);
+	}
+	std::vector<int> parallelSizes;
+	REQUIRE(parallel.components(parallelSizes) == serial.components(sizes));
+	REQUIRE(parallelSizes == sizes);
+	REQUIRE(serial.numConnectedComponents() == (int)sizes.size());
+	REQUIRE(parallel.numConnectedComponents() == (int)sizes.size());
+}
+
+TEST_CASE("strongComponents(std::vector<int> &sizes)", "Strongly connected components") {
+	// 1 -> 2 -> 3 -> 1 is a cycle, 4 <-> 5 another, 6 hangs off 5
+	Graph G(DIRECTED);
+	G.addVertex();
+	G.addEdge(1, 2, 1.0);
+	G.addEdge(2, 3, 1.0);
+	G.addEdge(3, 1, 1.0);
+	G.addEdge(3, 4, 1.0);
+	G.addEdge(4, 5, 1.0);
+	G.addEdge(5, 4, 1.0);
+	G.addEdge(5, 6, 1.0);
+	G.addEdge(6, 6, 1.0);
+	std::vector<int> sizes;
+	REQUIRE(G.strongComponents(sizes) == std::vector<int>({-1, 0, 0, 0, 1, 1, 2}));
+	REQUIRE(sizes == std::vector<int>({3, 2, 1}));
+
+	// Forward-backward on four threads splits a random graph, a giant
+	// component and many small ones, the same way as Tarjan's algorithm
+	const int n = 60000;
+	Graph serial(DIRECTED), parallel(DIRECTED);
+	parallel.setThreads(4);
+	serial.addVertex();
+	parallel.addVertex();
+	std::mt19937 random(1019);
+	for (int i = 0; i < n * 3 / 2; ++i) {
+		int v1 = random() % n + 1, v2 = random() % n + 1;
+		serial.addEdge(v1, v2, 1.0);
+		parallel.addEdge(v1, v2, 1.0);
+	}
+	std::vector<int> parallelSizes;
+	std::vector<int> id = serial.strongComponents(sizes);
+	REQUIRE(parallel.strongComponents(parallelSizes) == id);
+	REQUIRE(parallelSizes == sizes);
+	REQUIRE(*std::max_element(sizes.begin(), sizes.end()) > n / 4);
+
+	// Each node shares a component with exactly the nodes it reaches and
+	// is reached by, checked on a sample
+	int wrong = 0;
+	for (int i = 0; i < 20; ++i) {
+		int v1 = random() % n + 1, v2 = random() % n + 1;
+		bool strong = serial.closeness(v1, v2) >= 0 && serial.closeness(v2, v1) >= 0;
+		wrong += strong != (id[v1] == id[v2]);
+	}
+	REQUIRE(wrong == 0);
+}
+
+TEST_CASE("closeness(int v1, int v2)", "Minimum number of edges") {
+	Graph G(UNDIRECTED);
+	G.readFromFile("g1.txt");
+	REQUIRE(G.closeness(1, 1) == 0);
+	REQUIRE(G.closeness(1, 2) == 1);
+	REQUIRE(G.closeness(5, 1) == 2);
+	REQUIRE(G.closeness(1, 6) == -1);
+	REQUIRE(G.closeness(1, 7) == -1);
+
+	Graph G2(DIRECTED);
+	G2.readFromFile("g2.txt");
+	REQUIRE(G2.closeness(1, 3) == 2);
+	REQUIRE(G2.closeness(3, 1) == -1);
+	REQUIRE(G2.closeness(4, 6) == 2);
+
+	// Long paths are not capped
+	Graph path(UNDIRECTED);
+	path.addVertex();
+	for (int i = 1; i < 1000; ++i) {
+		path.addEdge(i, i + 1, 1.0);
+	}
+	REQUIRE(path.closeness(1, 1000) == 999);
+	REQUIRE(path.closeness(1000, 2) == 998);
+
+	// Batches answer each pair in order
+	std::vector<std::pair<int, int>> pairs = {{1, 3}, {3, 1}, {4, 6}, {7, 7}, {6, 4}};
+	std::vector<int> distances = G2.closeness(pairs);
+	REQUIRE(distances == std::vector<int>({2, -1, 2, 0, -1}));
+
+	// Agree with a plain breadth first search on a random directed graph
+	const int n = 300;
+	std::vector<std::vector<int>> out(n + 1);
+	Graph random(DIRECTED);
+	random.addVertex();
+	for (int i = 0; i < 3 * n / 2; ++i) {
+		int v1 = (i * 7919) % n + 1;
+		int v2 = (i * 104729 + 17) % n + 1;
+		random.addEdge(v1, v2, 1.0);
+		out[v1].push_back(v2);
+	}
+	int mismatched = 0;
+	for (int source = 1; source <= n; source += 7) {
+		std::vector<int> hops(n + 1, -1);
+		std::vector<int> queue(1, source);
+		hops[source] = 0;
+		for (size_t i = 0; i < queue.size(); ++i) {
+			for (int next : out[queue[i]]) {
+				if (hops[next] < 0) {
+					hops[next] = hops[queue[i]] + 1;
+					queue.push_back(next);
+				}
+			}
+		}
+		for (int target = 1; target <= n; ++target) {
+			mismatched += random.closeness(source, target) != hops[target];
+		}
+	}
+	REQUIRE(mismatched == 0);
+
+	// Batches spread over threads borrow a workspace each
+	random.setThreads(4);
+	std::vector<std::pair<int, int>> all;
+	for (int v1 = 1; v1 <= n; v1 += 3) {
+		for (int v2 = 1; v2 <= n; v2 += 5) {
+			all.push_back(std::make_pair(v1, v2));
+		}
+	}
+	std::vector<int> batched = random.closeness(all);
+	mismatched = 0;
+	for (size_t i = 0; i < all.size(); ++i) {
+		mismatched += batched[i] != random.closeness(all[i].first, all[i].second);
+	}
+	REQUIRE(mismatched == 0);
+}
+
+TEST_CASE("buildHubLabels()", "Closeness from hub labels") {
+	Graph G(UNDIRECTED);
+	G.readFromFile("g1.txt");
+	G.buildHubLabels();
+	REQUIRE(G.closeness(1, 4) == 2);
+	REQUIRE(G.closeness(1, 3) == -1);
+	REQUIRE(G.closeness(2, 2) == 0);
+
+	// Labels built on one thread or several, or mapped from a file, must
+	// agree with searching
+	const int n = 3000;
+	for (int undirected = 0; undirected < 2; ++undirected) {
+		Graph RG(undirected ? UNDIRECTED : DIRECTED);
+		RG.addVertex();
+		std::mt19937 random(1025 + undirected);
+		for (int i = 0; i < 2 * n; ++i) {
+			RG.addEdge(random() % n + 1, random() % n + 1, 1);
+		}
+		std::vector<std::pair<int, int>> pairs;
+		for (int i = 0; i < 5000; ++i) {
+			pairs.push_back(std::make_pair(random() % n + 1, random() % n + 1));
+		}
+		std::vector<int> expected = RG.closeness(pairs);
+		for (int round = 0; round < 3; ++round) {
+			if (round < 2) {
+				RG.setThreads(round ? 4 : 1);
+				RG.buildHubLabels();
+			} else {
+				REQUIRE(RG.writeHubLabels("test_hubs.bin"));
+				RG.compile();
+				REQUIRE(RG.mapHubLabels("test_hubs.bin"));
+			}
+			REQUIRE(RG.closeness(pairs) == expected);
+			int wrong = 0;
+			for (size_t i = 0; i < 500; ++i) {
+				wrong += RG.closeness(pairs[i].first, pairs[i].second) != expected[i];
+			}
+			REQUIRE(wrong == 0);
+		}
+
+		// Offsets follow the 56 byte header, and the last label's hub and
+		// hop count end the file. A rejected file keeps the labels mapped.
+		corruptCopy("test_hubs.bin", "test_bad.bin", 56 + 24, (std::uint64_t)1 << 40);
+		REQUIRE_FALSE(RG.mapHubLabels("test_bad.bin"));
+		corruptCopy("test_hubs.bin", "test_bad.bin", -8, (std::uint32_t)n);
+		REQUIRE_FALSE(RG.mapHubLabels("test_bad.bin"));
+		corruptCopy("test_hubs.bin", "test_bad.bin", -4, (std::uint32_t)-1);
+		REQUIRE_FALSE(RG.mapHubLabels("test_bad.bin"));
+		corruptCopy("test_hubs.bin", "test_bad.bin", 48, (std::uint64_t)-1);
+		REQUIRE_FALSE(RG.mapHubLabels("test_bad.bin"));
+		REQUIRE(RG.closeness(pairs) == expected);
+
+		// Changing the graph drops the labels
+		RG.addEdge(pairs[0].first, pairs[0].second, 1);
+		REQUIRE(RG.closeness(pairs[0].first, pairs[0].second) == (pairs[0].first != pairs[0].second));
+		REQUIRE_FALSE(RG.mapHubLabels("test_hubs.bin"));
+	}
+}
+
+TEST_CASE("closeness and stepAway from many sources", "Multi-source search") {
+	// 100 sources make one full batch of 64 and a partial one
+	const int n = 20000;
+	Graph G(DIRECTED);
+	G.setThreads(4);
+	G.addVertex();
+	std::mt19937 random(1020);
+	for (int i = 0; i < 3 * n; ++i) {
+		G.addEdge(random() % n + 1, random() % n + 1, 1.0);
+	}
+	G.addVertex();
+	std::vector<int> sources;
+	for (int i = 0; i < 100; ++i) {
+		sources.push_back(random() % (n + 1) + 1);
+	}
+	sources.push_back(sources[0]);
+
+	std::vector<std::vector<int>> distances = G.closeness(sources);
+	REQUIRE(distances.size() == sources.size());
+	int wrong = 0;
+	for (size_t i = 0; i < sources.size(); ++i) {
+		for (int j = 0; j < 50; ++j) {
+			int v = random() % (n + 1) + 1;
+			wrong += distances[i][v] != G.closeness(sources[i], v);
+		}
+	}
+	REQUIRE(wrong == 0);
+	REQUIRE(distances.back() == distances.front());
+
+	for (int steps : {2, 5, -1}) {
+		std::vector<std::vector<int>> levels = G.stepAway(sources, steps);
+		for (size_t i = 0; i < sources.size(); i += 17) {
+			G.stepAway(sources[i], steps, "test_large-stepaway.txt");
+			std::ifstream in("test_large-stepaway.txt");
+			std::vector<int> expected;
+			int node;
+			while (in >> node) {
+				expected.push_back(node);
+			}
+			std::sort(expected.begin(), expected.end());
+			REQUIRE(levels[i] == expected);
+		}
+	}
+}
+
+TEST_CASE("shortestPaths(int, distance, predecessor, target)", "Weighted shortest paths") {
+	Graph G(UNDIRECTED);
+	G.readFromFile("g1.txt");
+	std::vector<double> distance;
+	std::vector<int> predecessor;
+	REQUIRE(G.shortestPaths(1, distance, predecessor));
+	REQUIRE(distance[5] == Approx(5.4));
+	REQUIRE(predecessor[5] == 2);
+	REQUIRE(distance[4] == Approx(7.9));
+	REQUIRE(predecessor[4] == 2);
+	REQUIRE(distance[3] == std::numeric_limits<double>::infinity());
+	REQUIRE(predecessor[1] == -1);
+
+	// Each way along a directed pair has its own weight; check against
+	// relaxing every edge until nothing changes
+	const int n = 2000;
+	Graph DG(DIRECTED);
+	DG.addVertex();
+	std::mt19937 random(1021);
+	std::vector<std::pair<std::pair<int, int>, double>> edges;
+	for (int i = 0; i < 4 * n; ++i) {
+		int v1 = random() % n + 1, v2 = random() % n + 1;
+		double weight = (random() % 10000) / 100.0;
+		DG.addEdge(v1, v2, weight);
+		edges.push_back(std::make_pair(std::make_pair(v1, v2), weight));
+	}
+	std::vector<double> expected(n + 1, std::numeric_limits<double>::infinity());
+	expected[1] = 0;
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (const auto &edge : edges) {
+			double through = expected[edge.first.first] + edge.second;
+			if (through < expected[edge.first.second]) {
+				expected[edge.first.second] = through;
+				changed = true;
+			}
+		}
+	}
+	REQUIRE(DG.shortestPaths(1, distance, predecessor));
+	int wrong = 0;
+	for (int v = 1; v <= n; ++v) {
+		wrong += std::abs(distance[v] - expected[v]) > 1e-9 && distance[v] != expected[v];
+		if (predecessor[v] >= 0) {
+			wrong += distance[predecessor[v]] > distance[v];
+		}
+	}
+	REQUIRE(wrong == 0);
+
+	// Stopping at a target still settles the target
+	int target = 0;
+	for (int v = n; v > 1 && target == 0; --v) {
+		if (expected[v] < std::numeric_limits<double>::infinity()) {
+			target = v;
+		}
+	}
+	REQUIRE(DG.shortestPaths(1, distance, predecessor, target));
+	REQUIRE(distance[target] == Approx(expected[target]));
+
+	DG.addEdge(1, 2, -1.0);
+	REQUIRE_FALSE(DG.shortestPaths(1, distance, predecessor));
+}
+
+TEST_CASE("shortestPathsParallel(int, distance, predecessor, delta)", "Delta-stepping shortest paths") {
+	Graph G(UNDIRECTED);
+	G.readFromFile("g1.txt");
+	std::vector<double> distance;
+	std::vector<int> predecessor;
+	REQUIRE(G.shortestPathsParallel(1, distance, predecessor));
+	REQUIRE(distance[5] == Approx(5.4));
+	REQUIRE(predecessor[5] == 2);
+	REQUIRE(distance[3] == std::numeric_limits<double>::infinity());
+
+	// Weights of zero included, so predecessors must not go round in
+	// circles; every delta has to agree with Dijkstra
+	const int n = 20000;
+	Graph LG(UNDIRECTED);
+	LG.addVertex();
+	std::mt19937 random(1022);
+	for (int i = 0; i < 5 * n; ++i) {
+		LG.addEdge(random() % n + 1, random() % n + 1, (random() % 1000) / 10.0);
+	}
+	std::vector<double> expected;
+	REQUIRE(LG.shortestPaths(1, expected, predecessor));
+	LG.setThreads(4);
+	double deltas[] = {0, 0.5, 10, 1000};
+	for (double delta : deltas) {
+		REQUIRE(LG.shortestPathsParallel(1, distance, predecessor, delta));
+		int wrong = 0;
+		for (int v = 1; v <= n; ++v) {
+			wrong += distance[v] != Approx(expected[v]) && distance[v] != expected[v];
+			int steps = 0;
+			for (int u = v; predecessor[u] >= 0 && steps <= n; u = predecessor[u]) {
+				wrong += distance[predecessor[u]] > distance[u];
+				++steps;
+			}
+			wrong += steps > n;
+		}
+		REQUIRE(wrong == 0);
+	}
+
+	// One heavy edge far beyond the light ones leaves nearly every bucket
+	// up to it empty
+	Graph HG(UNDIRECTED);
+	HG.addVertex();
+	HG.setThreads(4);
+	for (int i = 0; i < 5 * 5000; ++i) {
+		HG.addEdge(random() % 5000 + 1, random() % 5000 + 1, 0.001 + (random() % 10) / 1000.0);
+	}
+	HG.addEdge(1, 5001, 1e9);
+	HG.addEdge(5001, 5002, 1e300);
+	REQUIRE(HG.shortestPaths(1, expected, predecessor));
+	double heavyDeltas[] = {0, 0.01, 1e-300};
+	for (double delta : heavyDeltas) {
+		REQUIRE(HG.shortestPathsParallel(1, distance, predecessor, delta));
+		int wrong = 0;
+		for (int v = 1; v <= 5002; ++v) {
+			wrong += distance[v] != Approx(expected[v]) && distance[v] != expected[v];
+		}
+		REQUIRE(wrong == 0);
+		REQUIRE(distance[5002] == expected[5002]);
+		REQUIRE(predecessor[5002] == 5001);
+	}
+
+	LG.addEdge(1, 2, -1.0);
+	REQUIRE_FALSE(LG.shortestPathsParallel(1, distance, predecessor));
+}
+
+TEST_CASE("shortestPath(int, int, distance, path)", "Point to point shortest paths with landmarks") {
+	Graph G(UNDIRECTED);
+	G.readFromFile("g1.txt");
+	double distance;
+	std::vector<int> path;
+	REQUIRE(G.shortestPath(1, 5, distance, path));
+	REQUIRE(distance == Approx(5.4));
+	REQUIRE(path == std::vector<int>({1, 2, 5}));
+	REQUIRE(G.buildLandmarks(2));
+	REQUIRE(G.shortestPath(1, 5, distance, path));
+	REQUIRE(path == std::vector<int>({1, 2, 5}));
+	REQUIRE(G.shortestPath(1, 3, distance, path));
+	REQUIRE(distance == std::numeric_limits<double>::infinity());
+	REQUIRE(path.empty());
+
+	// Paths must add up along real edges to what Dijkstra finds, with or
+	// without landmarks, and with landmarks read back from a file
+	const int n = 3000;
+	Graph DG(DIRECTED);
+	DG.addVertex();
+	std::mt19937 random(1023);
+	std::map<std::pair<int, int>, double> lightest;
+	for (int i = 0; i < 3 * n; ++i) {
+		int v1 = random() % n + 1, v2 = random() % n + 1;
+		double weight = (random() % 10000) / 100.0;
+		DG.addEdge(v1, v2, weight);
+		std::pair<int, int> arc(v1, v2);
+		if (!lightest.count(arc) || weight < lightest[arc]) {
+			lightest[arc] = weight;
+		}
+	}
+	std::vector<std::vector<double>> expected(10);
+	std::vector<int> predecessor;
+	for (int s = 0; s < 10; ++s) {
+		REQUIRE(DG.shortestPaths(s * 97 + 1, expected[s], predecessor));
+	}
+	for (int round = 0; round < 3; ++round) {
+		if (round == 1) {
+			REQUIRE(DG.buildLandmarks(8));
+			REQUIRE(DG.writeLandmarks("test_landmarks.bin"));
+		} else if (round == 2) {
+			DG.compile();
+			REQUIRE(DG.readLandmarks("test_landmarks.bin"));
+		}
+		int wrong = 0;
+		for (int s = 0; s < 10; ++s) {
+			int source = s * 97 + 1;
+			for (int target = 1; target <= n; target += 37) {
+				wrong += !DG.shortestPath(source, target, distance, path);
+				double total = 0;
+				for (size_t i = 1; i < path.size(); ++i) {
+					std::pair<int, int> arc(path[i - 1], path[i]);
+					total += lightest.count(arc) ? lightest[arc] : std::numeric_limits<double>::infinity();
+				}
+				wrong += distance != Approx(expected[s][target]) && distance != expected[s][target];
+				wrong += !path.empty() && (path.front() != source || path.back() != target || total != Approx(distance));
+				wrong += path.empty() != (distance == std::numeric_limits<double>::infinity());
+			}
+		}
+		REQUIRE(wrong == 0);
+	}
+
+	// Landmarks belong to the graph they were built for
+	REQUIRE_FALSE(G.readLandmarks("test_landmarks.bin"));
+	// A count the file cannot hold is turned down before any allocation,
+	// as is a file cut short
+	corruptCopy("test_landmarks.bin", "test_bad.bin", 20, (std::uint32_t)(n - 1));
+	REQUIRE_FALSE(DG.readLandmarks("test_bad.bin"));
+	{
+		std::string contents = fileContents("test_landmarks.bin");
+		std::ofstream out("test_bad.bin", std::ios::binary);
+		out << contents.substr(0, contents.size() / 2);
+	}
+	REQUIRE_FALSE(DG.readLandmarks("test_bad.bin"));
+	REQUIRE(DG.readLandmarks("test_landmarks.bin"));
+	DG.addEdge(1, 2, 1.0);
+	REQUIRE_FALSE(DG.readLandmarks("test_landmarks.bin"));
+	DG.addEdge(1, 3, -1.0);
+	REQUIRE_FALSE(DG.buildLandmarks(4));
+	REQUIRE_FALSE(DG.shortestPath(1, 3, distance, path));
+}
+
+TEST_CASE("buildHierarchy()", "Shortest paths through a contraction hierarchy") {
+	Graph G(UNDIRECTED);
+	G.readFromFile("g1.txt");
+	double distance;
+	std::vector<int> path;
+	REQUIRE(G.buildHierarchy());
+	REQUIRE(G.shortestPath(1, 5, distance, path));
+	REQUIRE(distance == Approx(5.4));
+	REQUIRE(path == std::vector<int>({1, 2, 5}));
+	REQUIRE(G.shortestPath(1, 3, distance, path));
+	REQUIRE(distance == std::numeric_limits<double>::infinity());
+	REQUIRE(path.empty());
+
+	// Unpacked paths must follow real edges, on directed and undirected
+	// road-like grids (with one-way streets when directed), and a
+	// hierarchy read back from a file must answer the same
+	const int side = 40, n = side * side;
+	for (int undirected = 0; undirected < 2; ++undirected) {
+		Graph RG(undirected ? UNDIRECTED : DIRECTED);
+		RG.addVertex();
+		std::mt19937 random(1024 + undirected);
+		std::map<std::pair<int, int>, double> lightest;
+		auto road = [&](int v1, int v2) {
+			double weight = 1 + (random() % 10000) / 100.0;
+			RG.addEdge(v1, v2, weight);
+			for (int way = 0; way <= undirected; ++way) {
+				std::pair<int, int> arc = way ? std::make_pair(v2, v1) : std::make_pair(v1, v2);
+				if (!lightest.count(arc) || weight < lightest[arc]) {
+					lightest[arc] = weight;
+				}
+			}
+		};
+		for (int v = 1; v <= n; ++v) {
+			int across[] = {(v - 1) % side + 1 < side ? v + 1 : 0, v + side <= n ? v + side : 0};
+			for (int next : across) {
+				if (next == 0 || random() % 8 == 0) {
+					continue;
+				}
+				int way = random() % 4;
+				if (way != 1) {
+					road(v, next);
+				}
+				if (way != 0 && !undirected) {
+					road(next, v);
+				}
+			}
+		}
+		std::vector<std::vector<double>> expected(10);
+		std::vector<int> predecessor;
+		for (int s = 0; s < 10; ++s) {
+			REQUIRE(RG.shortestPaths(s * 97 + 1, expected[s], predecessor));
+		}
+		REQUIRE(RG.buildHierarchy());
+		REQUIRE(RG.writeHierarchy("test_hierarchy.bin"));
+		for (int round = 0; round < 2; ++round) {
+			if (round == 1) {
+				REQUIRE(RG.readHierarchy("test_hierarchy.bin"));
+			}
+			int wrong = 0;
+			for (int s = 0; s < 10; ++s) {
+				int source = s * 97 + 1;
+				for (int target = 1; target <= n; target += 37) {
+					wrong += !RG.shortestPath(source, target, distance, path);
+					double total = 0;
+					for (size_t i = 1; i < path.size(); ++i) {
+						std::pair<int, int> arc(path[i - 1], path[i]);
+						total += lightest.count(arc) ? lightest[arc] : std::numeric_limits<double>::infinity();
+					}
+					wrong += distance != Approx(expected[s][target]) && distance != expected[s][target];
+					wrong += !path.empty() && (path.front() != source || path.back() != target || total != Approx(distance));
+					wrong += path.empty() != (distance == std::numeric_limits<double>::infinity());
+				}
+			}
+			REQUIRE(wrong == 0);
+		}
+
+		// Offsets follow the 56 byte header, and the last down arc's
+		// middle vertex ends the file
+		corruptCopy("test_hierarchy.bin", "test_bad.bin", 56 + 16, (std::uint64_t)1 << 40);
+		REQUIRE_FALSE(RG.readHierarchy("test_bad.bin"));
+		corruptCopy("test_hierarchy.bin", "test_bad.bin", -4, (std::int32_t)(n + 1));
+		REQUIRE_FALSE(RG.readHierarchy("test_bad.bin"));
+		corruptCopy("test_hierarchy.bin", "test_bad.bin", 48, (std::uint64_t)-1);
+		REQUIRE_FALSE(RG.readHierarchy("test_bad.bin"));
+	}
+
+	// Hierarchies belong to the graph they were built for
+	REQUIRE_FALSE(G.readHierarchy("test_hierarchy.bin"));
+	G.addEdge(1, 3, -1.0);
+	REQUIRE_FALSE(G.buildHierarchy());
+}
+
 TEST_CASE("bool partitionable()", "Is partitionable") {
 	Graph G(UNDIRECTED);
 	G.readFromFile("g1.txt");
@@ -143,6 +1061,65 @@ TEST_CASE("MST(std::string)", "Minimum spanning tree") {
 	Graph G2(DIRECTED);
 	G2.readFromFile("g2.txt");
 	REQUIRE(G2.MST("g2-mst.txt"));
+
+	// Equal weights are all candidates, taken by their end vertices
+	Graph G3(UNDIRECTED);
+	G3.addVertex();
+	G3.addEdge(1, 2, 1.0);
+	G3.addEdge(2, 3, 1.0);
+	G3.addEdge(3, 4, 1.0);
+	G3.addEdge(4, 1, 1.0);
+	G3.addEdge(1, 3, -0.5);
+	REQUIRE(G3.MST("test_mst.txt"));
+	REQUIRE(fileContents("test_mst.txt") == "{ {1, 2, 3, 4}, { (1, 3, -0.5), (1, 2, 1), (1, 4, 1) } }\n");
+
+	// Sorting the weights on several threads picks the same forest
+	Graph serial(UNDIRECTED), parallel(UNDIRECTED);
+	parallel.setThreads(4);
+	serial.addVertex();
+	parallel.addVertex();
+	std::mt19937 random(1012);
+	for (int i = 0; i < 100000; ++i) {
+		int v1 = random() % 30000 + 1, v2 = random() % 30000 + 1;
+		double weight = int(random() % 2000) - 1000 + (random() % 4) / 4.0;
+		serial.addEdge(v1, v2, weight);
+		parallel.addEdge(v1, v2, weight);
+	}
+	REQUIRE(serial.MST("test_large-mst.txt"));
+	REQUIRE(parallel.MST("test_large-mst-parallel.txt"));
+	REQUIRE(fileContents("test_large-mst-parallel.txt") == fileContents("test_large-mst.txt"));
+
+	// So do the other methods
+	REQUIRE(serial.MST("test_large-mst-filter.txt", FILTER_KRUSKAL));
+	REQUIRE(fileContents("test_large-mst-filter.txt") == fileContents("test_large-mst.txt"));
+	REQUIRE(G.MST("test_large-mst-filter.txt", FILTER_KRUSKAL));
+	REQUIRE(fileContents("test_large-mst-filter.txt") == fileContents("g1-mst.txt"));
+	REQUIRE(parallel.MST("test_large-mst-boruvka.txt", BORUVKA));
+	REQUIRE(fileContents("test_large-mst-boruvka.txt") == fileContents("test_large-mst.txt"));
+	REQUIRE(G.MST("test_large-mst-boruvka.txt", BORUVKA));
+	REQUIRE(fileContents("test_large-mst-boruvka.txt") == fileContents("g1-mst.txt"));
+	REQUIRE(serial.MST("test_large-mst-prim.txt", PRIM));
+	REQUIRE(fileContents("test_large-mst-prim.txt") == fileContents("test_large-mst.txt"));
+	REQUIRE(G.MST("test_large-mst-prim.txt", PRIM));
+	REQUIRE(fileContents("test_large-mst-prim.txt") == fileContents("g1-mst.txt"));
+	REQUIRE(G2.MST("test_large-mst-prim.txt", PRIM));
+	REQUIRE(fileContents("test_large-mst-prim.txt") == fileContents("g2-mst.txt"));
+	REQUIRE(G3.MST("test_mst.txt", PRIM));
+	REQUIRE(fileContents("test_mst.txt") == "{ {1, 2, 3, 4}, { (1, 3, -0.5), (1, 2, 1), (1, 4, 1) } }\n");
+	REQUIRE(G3.MST("test_mst.txt", BORUVKA));
+	REQUIRE(fileContents("test_mst.txt") == "{ {1, 2, 3, 4}, { (1, 3, -0.5), (1, 2, 1), (1, 4, 1) } }\n");
+
+	// Weights falling along a path hook every vertex onto the next one, so
+	// the first round merges one tree down a chain as long as the path
+	Graph path(UNDIRECTED);
+	path.setThreads(4);
+	path.addVertex();
+	for (int i = 1; i < 80000; ++i) {
+		path.addEdge(i, i + 1, 80000 - i);
+	}
+	REQUIRE(path.MST("test_large-mst-path.txt", KRUSKAL));
+	REQUIRE(path.MST("test_large-mst-path-boruvka.txt", BORUVKA));
+	REQUIRE(fileContents("test_large-mst-path-boruvka.txt") == fileContents("test_large-mst-path.txt"));
 }
 
 TEST_CASE("stepAway(int source, int closeness, std::string file)", "Find nodes of of n degrees away") {